@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -22,33 +22,104 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "kstat.h"
 
-struct {
+// Buffers hash by (dev, blockno) into NBUCKET buckets, each
+// with its own lock and its own LRU list, so lookups of
+// different blocks seldom contend. A miss recycles the least
+// recently used free buffer of its own bucket, or else steals
+// one from another bucket; no two bucket locks are ever held
+// at once.
+#define NBUCKET 31
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
 
-  // Linked list of all buffers, through prev/next.
+  // Linked list of the bucket's buffers, through prev/next.
   // head.next is most recently used.
   struct buf head;
+};
+
+struct {
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+static struct bucket*
+bucketof(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 1000003 ^ blockno) % NBUCKET];
+}
+
+// Caller must hold the bucket's lock.
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+// Make b the bucket's most recently used buffer.
+// Caller must hold the bucket's lock.
+static void
+bpush(struct bucket *bk, struct buf *b)
+{
+  b->next = bk->head.next;
+  b->prev = &bk->head;
+  bk->head.next->prev = b;
+  bk->head.next = b;
+}
+
+// The cache gets 1/BCACHEFRAC of the memory free at boot,
+// and at least NBUF buffers. Buffer headers and their data
+// are carved out of whole pages.
 void
 binit(void)
 {
-  struct buf *b;
+  struct bucket *bk;
+  struct buf *b = 0;
+  char *data = 0;
+  int i, nbuf;
+
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
 
-  initlock(&bcache.lock, "bcache");
+  nbuf = kfreemem() / BCACHEFRAC * (PGSIZE / BSIZE);
+  if(nbuf < NBUF)
+    nbuf = NBUF;
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+  for(i = 0; i < nbuf; i++){
+    if(i % (PGSIZE / sizeof(struct buf)) == 0 && (b = kalloc_kernel()) == 0)
+      break;
+    if(i % (PGSIZE / BSIZE) == 0 && (data = kalloc_kernel()) == 0)
+      break;
+    memset(b, 0, sizeof(*b));
+    b->data = (uchar*)data + (i % (PGSIZE / BSIZE)) * BSIZE;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    bpush(&bcache.bucket[i % NBUCKET], b);
+    b++;
   }
+  if(i < NBUF)
+    panic("binit");
+  kstats.nbuf = i;
+}
+
+// Take the least recently used free buffer out of a bucket.
+// Caller must hold the bucket's lock.
+static struct buf*
+bvictim(struct bucket *bk)
+{
+  struct buf *b;
+
+  for(b = bk->head.prev; b != &bk->head; b = b->prev){
+    if(b->refcnt == 0) {
+      bunlink(b);
+      return b;
+    }
+  }
+  return 0;
 }
 
 // Look through buffer cache for block on device dev.
@@ -57,33 +128,60 @@ binit(void)
 static struct buf*
 bget(uint dev, uint blockno)
 {
-  struct buf *b;
+  struct bucket *bk = bucketof(dev, blockno), *other;
+  struct buf *b, *victim;
 
-  acquire(&bcache.lock);
+  acquire(&bk->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = bk->head.next; b != &bk->head; b = b->next){
     if(b->dev == dev && b->blockno == blockno){
       b->refcnt++;
-      release(&bcache.lock);
+      release(&bk->lock);
+      __sync_fetch_and_add(&kstats.bhits, 1);
       acquiresleep(&b->lock);
       return b;
     }
   }
+  __sync_fetch_and_add(&kstats.bmisses, 1);
 
-  // Not cached; recycle an unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // Not cached; recycle an unused buffer, from this
+  // bucket if possible, else from the others.
+  if((victim = bvictim(bk)) == 0){
+    release(&bk->lock);
+    for(other = bcache.bucket; other < bcache.bucket+NBUCKET && victim == 0; other++){
+      if(other == bk)
+        continue;
+      acquire(&other->lock);
+      victim = bvictim(other);
+      release(&other->lock);
+    }
+    if(victim == 0)
+      panic("bget: no buffers");
+    acquire(&bk->lock);
+
+    // someone may have cached the block meanwhile.
+    for(b = bk->head.next; b != &bk->head; b = b->next){
+      if(b->dev == dev && b->blockno == blockno){
+        b->refcnt++;
+        victim->valid = 0;
+        bpush(bk, victim);
+        release(&bk->lock);
+        acquiresleep(&b->lock);
+        return b;
+      }
     }
   }
-  panic("bget: no buffers");
+
+  b = victim;
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  bpush(bk, b);
+  release(&bk->lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -100,6 +198,63 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Disk interrupt callback for a block read ahead: the
+// buf now holds valid data, and no one is using it.
+static void
+bradone(struct buf *b)
+{
+  struct bucket *bk = bucketof(b->dev, b->blockno);
+
+  b->valid = 1;
+  b->iodone = 0;
+  releasesleep(&b->lock);
+  acquire(&bk->lock);
+  b->refcnt--;
+  release(&bk->lock);
+}
+
+// Start reading blocks[0..n-1] of dev into the cache,
+// without waiting for them. A reader that asks for one
+// before it arrives waits on its lock in bget(). Blocks
+// already cached are skipped, and so are blocks whose
+// bucket has no free buffer; readahead is only a hint.
+void
+breadahead(uint dev, uint *blocks, int n)
+{
+  struct bucket *bk;
+  struct buf *b, *list = 0, **tailp = &list;
+  int i;
+
+  for(i = 0; i < n; i++){
+    bk = bucketof(dev, blocks[i]);
+    acquire(&bk->lock);
+    for(b = bk->head.next; b != &bk->head; b = b->next)
+      if(b->dev == dev && b->blockno == blocks[i])
+        break;
+    if(b != &bk->head || (b = bvictim(bk)) == 0){
+      release(&bk->lock);
+      continue;
+    }
+    b->dev = dev;
+    b->blockno = blocks[i];
+    b->valid = 0;
+    b->refcnt = 1;
+    bpush(bk, b);
+    // lock it before anyone can find it, so that no one reads
+    // the block meanwhile. it was free, so this won't sleep.
+    acquiresleep(&b->lock);
+    release(&bk->lock);
+
+    b->iodone = bradone;
+    b->qnext = 0;
+    *tailp = b;
+    tailp = &b->qnext;
+    __sync_fetch_and_add(&kstats.bahead, 1);
+  }
+  if(list)
+    virtio_disk_submit(list, 0);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -109,43 +264,62 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Write a list of locked bufs, linked through qnext, with
+// all of them in flight at once; returns when all are written.
+void
+bwritelist(struct buf *list)
+{
+  struct buf *b;
+
+  for(b = list; b; b = b->qnext){
+    if(!holdingsleep(&b->lock))
+      panic("bwritelist");
+    b->iodone = 0;
+  }
+  virtio_disk_submit(list, 1);
+  for(b = list; b; b = b->qnext)
+    virtio_disk_wait(b);
+}
+
 // Release a locked buffer.
-// Move to the head of the MRU list.
+// Move to the head of its bucket's MRU list.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  // b->dev and b->blockno can't change while b->refcnt > 0.
+  bk = bucketof(b->dev, b->blockno);
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    bunlink(b);
+    bpush(bk, b);
   }
   
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bucketof(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bucketof(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
-
-
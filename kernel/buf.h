@@ -8,6 +8,8 @@ struct buf {
   struct buf *prev; // LRU cache list
   struct buf *next;
   struct buf *qnext; // disk queue
-  uchar data[BSIZE];
+  void (*iodone)(struct buf*); // if set, called by the disk
+                               // interrupt when I/O is done
+  uchar *data; // BSIZE bytes; see binit()
 };
 
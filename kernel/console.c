@@ -28,6 +28,8 @@
 
 //
 // send one character to the uart.
+// called by printf, and to echo input characters,
+// but not from write().
 //
 void
 consputc(int c)
@@ -61,27 +63,86 @@ struct input {
 static int active = 1;
 struct input consoles[NCONS];
 
+// each console's recent output, whether or not it is
+// active, so that switching to it can replay it.
+// scroll.lock also protects active.
+#define SCROLLBACK 2048
+struct {
+  struct spinlock lock;
+  char buf[NCONS][SCROLLBACK];
+  uint64 w[NCONS];  // bytes ever output to each console
+} scroll;
+
+// remember that c was output to console major.
+// caller must hold scroll.lock.
+static void
+scrollput(int major, int c)
+{
+  scroll.buf[major-1][scroll.w[major-1]++ % SCROLLBACK] = c;
+}
+
+// output c to the active console, as consputc() does,
+// and remember it.
+static void
+echo(int c)
+{
+  acquire(&scroll.lock);
+  if(c == BACKSPACE){
+    scrollput(active, '\b'); scrollput(active, ' '); scrollput(active, '\b');
+  } else {
+    scrollput(active, c);
+  }
+  release(&scroll.lock);
+  consputc(c);
+}
+
+// make console major the active one, and show
+// what it has most recently output.
+static void
+consswitch(int major)
+{
+  uint64 i;
+
+  acquire(&scroll.lock);
+  active = major;
+  uartdiscard();  // the old console's; it's in its scrollback
+  printf("\nActive console now: %d\n", active);
+  i = scroll.w[active-1];
+  i = i > SCROLLBACK ? i - SCROLLBACK : 0;
+  for(; i < scroll.w[active-1]; i++)
+    consputc(scroll.buf[active-1][i % SCROLLBACK]);
+  release(&scroll.lock);
+}
+
 //
 // user write()s to the console go here.
+// copies a chunk at a time into the console's
+// scrollback, and, if it is the active console, lets
+// the uart send it from its output buffer. an inactive
+// console's output is only kept in memory.
 //
 int
 consolewrite(int major, int user_src, uint64 src, int n)
 {
-  int i;
-  struct input *cons = &consoles[active - 1];
-
-  acquire(&cons->lock);
-  for(i = 0; i < n; i++){
-    char c;
-    if(either_copyin(&c, user_src, src+i, 1) == -1)
+  char buf[64];
+  int i, j, m, show;
+
+  for(i = 0; i < n; i += m){
+    m = n - i;
+    if(m > sizeof(buf))
+      m = sizeof(buf);
+    if(either_copyin(buf, user_src, src+i, m) == -1)
       break;
-	if (major == active){
-	  consputc(c);
-	}
+    acquire(&scroll.lock);
+    for(j = 0; j < m; j++)
+      scrollput(major, buf[j]);
+    show = (major == active);
+    release(&scroll.lock);
+    if(show)
+      uartwrite(buf, m);
   }
-  release(&cons->lock);
 
-  return n;
+  return i;
 }
 
 //
@@ -164,14 +225,14 @@ consoleintr(int c)
     while(consa->e != consa->w &&
           consa->buf[(consa->e-1) % INPUT_BUF] != '\n'){
       consa->e--;
-      consputc(BACKSPACE);
+      echo(BACKSPACE);
     }
     break;
   case C('H'): // Backspace
   case '\x7f':
     if(consa->e != consa->w){
       consa->e--;
-      consputc(BACKSPACE);
+      echo(BACKSPACE);
     }
     break;
   case C('T'):
@@ -183,7 +244,7 @@ consoleintr(int c)
       c = (c == '\r') ? '\n' : c;
 
       // echo back to the user.
-      consputc(c);
+      echo(c);
 
       // store for consumption by consoleread().
       consa->buf[consa->e++ % INPUT_BUF] = c;
@@ -200,16 +261,15 @@ consoleintr(int c)
 
   release(&consa->lock);
 
-  if(doconsoleswitch){
-    active = (active % (NCONS + 1)) + 1;
-    printf("\nActive console now: %d\n", active);
-  }
+  if(doconsoleswitch)
+    consswitch(active % NCONS + 1);
 
 }
 
 void
 consoleinit(void)
 {
+  initlock(&scroll.lock, "scroll");
   for(int i = 0; i < NCONS; i++){
 	struct input cons;
 	initlock(&cons.lock, "cons1");
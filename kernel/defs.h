@@ -15,6 +15,8 @@ void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritelist(struct buf*);
+void            breadahead(uint, uint*, int);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
 
@@ -40,6 +42,7 @@ int             filewritefromkernel(struct file*, uint64, int);
 // fs.c
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
+int             dirunlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
@@ -49,10 +52,12 @@ void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
+void            ireown(struct container*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
+void            readahead(struct inode*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 struct inode*   namexinit(char *path, int nameiparent, char *name);
@@ -64,6 +69,15 @@ void            ramdiskrw(struct buf*);
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
+void*           kalloc_kernel(void);
+void            kfree_kernel(void *);
+void*           kalloc_pages(int);
+int             charge(struct container*, int);
+void            uncharge(struct container*, int);
+void            kfree_pages(void *, int);
+uint64          kfreemem(void);
+void            kref(void *);
+int             krefcnt(void *);
 void            kinit();
 
 // log.c
@@ -73,7 +87,7 @@ void            begin_op();
 void            end_op();
 
 // pipe.c
-int             pipealloc(struct file**, struct file**);
+int             pipealloc(struct file**, struct file**, int);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
@@ -108,8 +122,8 @@ int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
 
-struct ptable*  ptableof(struct container *c, int *sz);
-int             psinfo(uint64 ptable_pt, uint64 count_pt);
+struct ptable*  ptableof(struct container *c, int start, int *sz, int *next);
+int             psinfo(uint64 ptable_pt, int start, uint64 count_pt);
 int             suspend(int, struct file*);
 int             resume(char *filename);
 int             cinfo(uint64 ctable_pt, uint64 count_pt);
@@ -117,7 +131,10 @@ int             cinit(struct proc *p, char *name, char *root, int max_proc, int
 int             cpause(char *name);
 int             cresume(char *name);
 int             cstop(char *name);
+int             csched(char *name, int shares, int quota);
+void            cputick(void);
 int             isroot(struct container *c);
+extern struct kstat kstats;
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -153,6 +170,14 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// trace.c
+void            traceinit(void);
+void            traceset(struct proc*, int);
+uint64          tracecall(struct proc*, int, uint64 (*)(void));
+void            traceexit(struct proc*, int);
+void            tracewake(void);
+int             traceread(uint64, int);
+
 // trap.c
 extern uint ticks;
 void            trapinit(void);
@@ -164,6 +189,8 @@ void            usertrapret(void);
 void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
+void            uartwrite(char*, int);
+void            uartdiscard(void);
 int             uartgetc(void);
 
 // vm.c
@@ -177,6 +204,8 @@ void            uvminit(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcow(pagetable_t, uint64);
+int             uvmlazy(pagetable_t, uint64, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
@@ -184,6 +213,7 @@ uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
+void            utlbflush(struct proc*);
 
 // plic.c
 void            plicinit(void);
@@ -195,6 +225,8 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_submit(struct buf *, int);
+void            virtio_disk_wait(struct buf *);
 void            virtio_disk_intr();
 
 // sysproc.c
@@ -108,6 +108,7 @@ exec(char *path, char **argv)
   // Commit to the user image.
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
+  utlbflush(p);
   p->sz = sz;
   p->tf->epc = elf.entry;  // initial program counter = main
   p->tf->sp = sp; // initial stack pointer
@@ -137,6 +138,9 @@ loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz
   if((va % PGSIZE) != 0)
     panic("loadseg: va must be page aligned");
 
+  // get the whole segment on its way from the disk.
+  readahead(ip, offset, sz);
+
   for(i = 0; i < sz; i += PGSIZE){
     pa = walkaddr(pagetable, va + i);
     if(pa == 0)
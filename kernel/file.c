@@ -101,6 +101,39 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// Before reading n bytes from f, read ahead. Each sequential
+// read doubles the window, up to RAMAX blocks past the read;
+// a seek closes it. More blocks are requested once the reader
+// is within half a window of the end of those already asked for.
+// Caller must hold f->ip->lock.
+static void
+fileahead(struct file *f, int n)
+{
+  uint bn, last;
+
+  if(n <= 0)
+    return;
+  if(f->off != f->ranext){
+    f->rawin = 0;
+    return;
+  }
+  if(f->rawin == 0)
+    f->rawin = RAMIN;
+  else if(f->rawin < RAMAX)
+    f->rawin *= 2;
+  if(f->rawin > RAMAX)
+    f->rawin = RAMAX;
+
+  bn = f->off / BSIZE;
+  last = (f->off + n - 1) / BSIZE + f->rawin;
+  if(last < f->raend + f->rawin/2 && bn < f->raend)
+    return;
+  if(f->raend > bn)
+    bn = f->raend;
+  readahead(f->ip, bn*BSIZE, (last - bn)*BSIZE);
+  f->raend = last;
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int
@@ -119,8 +152,10 @@ fileread(struct file *f, uint64 addr, int n)
     r = devsw[f->major].read(f->major, 1, addr, n);
   } else if(f->type == FD_INODE){
     ilock(f->ip);
+    fileahead(f, n);
     if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
       f->off += r;
+    f->ranext = f->off;
     iunlock(f->ip);
   } else {
     panic("fileread");
@@ -147,8 +182,10 @@ filereadfromkernel(struct file *f, uint64 addr, int n)
     r = devsw[f->major].read(f->major, 0, addr, n);
   } else if(f->type == FD_INODE){
     ilock(f->ip);
+    fileahead(f, n);
     if((r = readi(f->ip, 0, addr, f->off, n)) > 0)
       f->off += r;
+    f->ranext = f->off;
     iunlock(f->ip);
   } else {
     panic("fileread");
@@ -176,11 +213,12 @@ filewrite(struct file *f, uint64 addr, int n)
   } else if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
     // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // i-node, double-indirect and indirect blocks,
+    // allocation blocks, and 2 blocks of slop for
+    // non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    int max = ((MAXOPBLOCKS-1-2-2) / 2) * BSIZE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
@@ -196,11 +234,11 @@ filewrite(struct file *f, uint64 addr, int n)
 
       if(r < 0)
         break;
-      if(r != n1)
-        panic("short filewrite");
       i += r;
+      if(r != n1)
+        break;  // out of disk space
     }
-    ret = (i == n ? n : -1);
+    ret = (i > 0 || n == 0 ? i : -1);
   } else {
     panic("filewrite");
   }
@@ -227,11 +265,12 @@ filewritefromkernel(struct file *f, uint64 addr, int n)
   } else if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
     // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // i-node, double-indirect and indirect blocks,
+    // allocation blocks, and 2 blocks of slop for
+    // non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    int max = ((MAXOPBLOCKS-1-2-2) / 2) * BSIZE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
@@ -247,11 +286,11 @@ filewritefromkernel(struct file *f, uint64 addr, int n)
 
       if(r < 0)
         break;
-      if(r != n1)
-        panic("short filewrite");
       i += r;
+      if(r != n1)
+        break;  // out of disk space
     }
-    ret = (i == n ? n : -1);
+    ret = (i > 0 || n == 0 ? i : -1);
   } else {
     panic("filewrite");
   }
@@ -6,6 +6,9 @@ struct file {
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
+  uint ranext;       // FD_INODE: off if reads are sequential
+  uint raend;        // FD_INODE: block after the last read ahead
+  int rawin;         // FD_INODE: readahead window, in blocks
   short major;       // FD_DEVICE
 };
 
@@ -13,11 +16,23 @@ struct file {
 #define minor(dev)  ((dev) & 0xFFFF)
 #define	mkdev(m,n)  ((uint)((m)<<16| (n)))
 
+// A run of consecutive disk blocks holding consecutive
+// blocks of a file.
+struct extent {
+  uint bn;    // first file block
+  uint addr;  // its disk block
+  uint len;   // number of blocks; 0 if unused
+};
+
+#define NEXTENT 4
+
 // in-memory copy of an inode
 struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *prev; // LRU list of its icache bucket
+  struct inode *next;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,7 +41,11 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
+
+  struct extent ext[NEXTENT]; // blocks bmap() has looked up
+  int extnext;                // next ext[] to replace
+  uint lastblock;             // block bmap() allocated last
 };
 
 // map major device number to device functions.
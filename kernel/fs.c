@@ -20,6 +20,7 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "kstat.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
@@ -27,6 +28,26 @@ static void itrunc(struct inode*);
 // only one device
 struct superblock sb;
 
+// Free-block summary: how many blocks are free in the range
+// each bitmap block covers, so that balloc() passes over full
+// ones without reading them, and where the last allocation
+// left off. A count changes only while its bitmap block's
+// buf is locked.
+#define NBMAP (FSSIZE/BPB + 1)
+
+struct {
+	struct spinlock lock;
+	uint hint;                 // Block after the last one allocated
+	int nfree[NBMAP];          // Free blocks per bitmap block
+} bsum;
+
+extern struct container containers[]; // proc.c
+
+static void bsuminit(int dev);
+static int ownerid(struct container *c);
+static void dcinit(void);
+static void dcpurge(struct inode *dp);
+
 // Read the super block.
 static void
 readsb(int dev, struct superblock *sb)
@@ -45,6 +66,7 @@ fsinit(int dev) {
 	if(sb.magic != FSMAGIC)
 		panic("invalid file system");
 	initlog(dev, &sb);
+	bsuminit(dev);
 }
 
 // Zero a block.
@@ -61,30 +83,61 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
-static uint
-balloc(uint dev)
+// Count the free blocks under each bitmap block.
+static void
+bsuminit(int dev)
 {
-	int b, bi, m;
 	struct buf *bp;
-	struct proc *p;
-	if((long)(p = myproc()) != -1) {
-		struct container *c = p->container;
-		if (isroot(c) == 0 && c->diskused >= c->disklimit) {
-			printf("kalloc: failed: container mem limit exceeded\n");
-			kill(p->pid);
-		}
-		c->diskused++;
-	}
+	int b, bi;
 
-	bp = 0;
+	if(sb.size > NBMAP*BPB)
+		panic("bsuminit: file system too big");
+	initlock(&bsum.lock, "bsum");
 	for(b = 0; b < sb.size; b += BPB) {
 		bp = bread(dev, BBLOCK(b, sb));
 		for(bi = 0; bi < BPB && b + bi < sb.size; bi++) {
+			if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+				bsum.nfree[b/BPB]++;
+		}
+		brelse(bp);
+	}
+}
+
+// Allocate a zeroed disk block, the first free one at or
+// after near if there is one, else after the last block
+// allocated, wrapping around. Returns 0 if the disk is full.
+static uint
+balloc(uint dev, uint near)
+{
+	int b, bi, m, i, k, nbmap;
+	struct buf *bp;
+
+	if(near == 0 || near >= sb.size)
+		near = bsum.hint % sb.size;
+	nbmap = (sb.size + BPB - 1) / BPB;
+
+	// Look at near's bitmap block from near on, then the
+	// others in turn, then near's again from the start.
+	for(k = 0; k <= nbmap; k++) {
+		i = (near / BPB + k) % nbmap;
+		if(bsum.nfree[i] == 0)
+			continue;
+		b = i * BPB;
+		bi = k == 0 ? near % BPB : 0;
+		bp = bread(dev, BBLOCK(b, sb));
+		for(; bi < BPB && b + bi < sb.size; bi++) {
+			if(bi % 8 == 0 && bp->data[bi/8] == 0xff) { // All 8 in use?
+				bi += 7;
+				continue;
+			}
 			m = 1 << (bi % 8);
 			if((bp->data[bi/8] & m) == 0) { // Is block free?
 				bp->data[bi/8] |= m; // Mark block in use.
 				log_write(bp);
+				acquire(&bsum.lock);
+				bsum.nfree[i]--;
+				bsum.hint = b + bi + 1;
+				release(&bsum.lock);
 				brelse(bp);
 				bzero(dev, b + bi);
 				return b + bi;
@@ -92,7 +145,7 @@ balloc(uint dev)
 		}
 		brelse(bp);
 	}
-	panic("balloc: out of blocks");
+	return 0;
 }
 
 // Free a disk block.
@@ -102,11 +155,6 @@ bfree(int dev, uint b)
 	struct buf *bp;
 	int bi, m;
 
-	struct container *c;
-	if((long)(c = mycont()) != -1) {
-		c->diskused--;
-	}
-
 	bp = bread(dev, BBLOCK(b, sb));
 	bi = b % BPB;
 	m = 1 << (bi % 8);
@@ -114,6 +162,9 @@ bfree(int dev, uint b)
 		panic("freeing free block");
 	bp->data[bi/8] &= ~m;
 	log_write(bp);
+	acquire(&bsum.lock);
+	bsum.nfree[b/BPB]++;
+	release(&bsum.lock);
 	brelse(bp);
 }
 
@@ -153,7 +204,9 @@ bfree(int dev, uint b)
 //   cache entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid if it frees the inode. A free entry stays
+//   valid until it is reused for another inode, so iget()
+//   of a recently used inode needn't read it again.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -177,42 +230,123 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// The icache is a hash table of entries, hashed by (dev, inum)
+// into NIBUCKET buckets, each with its own lock and LRU list;
+// it works like the buffer cache in bio.c. A bucket's lock
+// protects the allocation of its entries. Since ip->ref
+// indicates whether an entry is free, and ip->dev and ip->inum
+// indicate which i-node an entry holds, one must hold the
+// bucket's lock while using any of those fields, or the
+// LRU links.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+#define NIBUCKET 61
 
-struct {
+struct ibucket {
 	struct spinlock lock;
-	struct inode inode[NINODE];
+
+	// Linked list of the bucket's inodes, through prev/next.
+	// head.next is most recently used.
+	struct inode head;
+};
+
+struct {
+	struct ibucket bucket[NIBUCKET];
 } icache;
 
+static struct ibucket*
+ibucketof(uint dev, uint inum)
+{
+	return &icache.bucket[(dev * 1000003 ^ inum) % NIBUCKET];
+}
+
+// Caller must hold the bucket's lock.
+static void
+iunlink(struct inode *ip)
+{
+	ip->next->prev = ip->prev;
+	ip->prev->next = ip->next;
+}
+
+// Make ip the bucket's most recently used inode.
+// Caller must hold the bucket's lock.
+static void
+ipush(struct ibucket *bk, struct inode *ip)
+{
+	ip->next = bk->head.next;
+	ip->prev = &bk->head;
+	bk->head.next->prev = ip;
+	bk->head.next = ip;
+}
+
+// The cache gets an inode per ICACHEFRAC pages of the memory
+// free at boot, and at least NINODE, carved out of whole pages.
 void
 iinit()
 {
-	int i = 0;
+	struct ibucket *bk;
+	struct inode *ip = 0;
+	int i, ninode;
+
+	for(bk = icache.bucket; bk < icache.bucket+NIBUCKET; bk++) {
+		initlock(&bk->lock, "icache");
+		bk->head.prev = &bk->head;
+		bk->head.next = &bk->head;
+	}
+
+	ninode = kfreemem() / ICACHEFRAC;
+	if(ninode < NINODE)
+		ninode = NINODE;
+
+	for(i = 0; i < ninode; i++) {
+		if(i % (PGSIZE / sizeof(struct inode)) == 0 && (ip = kalloc_kernel()) == 0)
+			break;
+		memset(ip, 0, sizeof(*ip));
+		initsleeplock(&ip->lock, "inode");
+		ipush(&icache.bucket[i % NIBUCKET], ip);
+		ip++;
+	}
+	if(i < NINODE)
+		panic("iinit");
+	kstats.ninode = i;
+	dcinit();
+}
+
+// Take the least recently used free inode out of a bucket.
+// Caller must hold the bucket's lock.
+static struct inode*
+ivictim(struct ibucket *bk)
+{
+	struct inode *ip;
 
-	initlock(&icache.lock, "icache");
-	for(i = 0; i < NINODE; i++) {
-		initsleeplock(&icache.inode[i].lock, "inode");
+	for(ip = bk->head.prev; ip != &bk->head; ip = ip->prev) {
+		if(ip->ref == 0) {
+			iunlink(ip);
+			return ip;
+		}
 	}
+	return 0;
 }
 
 static struct inode* iget(uint dev, uint inum);
 
 // Allocate an inode on device dev.
-// Mark it as allocated by  giving it type type.
+// Mark it as allocated by  giving it type type,
+// and owned by the current process's container.
 // Returns an unlocked but allocated and referenced inode.
 struct inode*
 ialloc(uint dev, short type)
 {
-	int inum;
+	int inum, owner = 0;
 	struct buf *bp;
 	struct dinode *dip;
+	struct proc *p;
+
+	p = myproc();
+	if(p != 0 && (long)p != -1)
+		owner = ownerid(p->container);
 
 	for(inum = 1; inum < sb.ninodes; inum++) {
 		bp = bread(dev, IBLOCK(inum, sb));
@@ -220,6 +354,7 @@ ialloc(uint dev, short type)
 		if(dip->type == 0) { // a free inode
 			memset(dip, 0, sizeof(*dip));
 			dip->type = type;
+			dip->minor = owner;
 			log_write(bp); // mark it allocated on the disk
 			brelse(bp);
 			return iget(dev, inum);
@@ -257,32 +392,56 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-	struct inode *ip, *empty;
+	struct ibucket *bk = ibucketof(dev, inum), *other;
+	struct inode *ip, *victim;
 
-	acquire(&icache.lock);
+	acquire(&bk->lock);
 
 	// Is the inode already cached?
-	empty = 0;
-	for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++) {
-		if(ip->ref > 0 && ip->dev == dev && ip->inum == inum) {
+	for(ip = bk->head.next; ip != &bk->head; ip = ip->next) {
+		if(ip->dev == dev && ip->inum == inum) {
 			ip->ref++;
-			release(&icache.lock);
+			release(&bk->lock);
+			__sync_fetch_and_add(&kstats.ihits, 1);
 			return ip;
 		}
-		if(empty == 0 && ip->ref == 0) // Remember empty slot.
-			empty = ip;
+	}
+	__sync_fetch_and_add(&kstats.imisses, 1);
+
+	// Not cached; recycle a free entry, from this
+	// bucket if possible, else from the others.
+	if((victim = ivictim(bk)) == 0) {
+		release(&bk->lock);
+		for(other = icache.bucket; other < icache.bucket+NIBUCKET && victim == 0; other++) {
+			if(other == bk)
+				continue;
+			acquire(&other->lock);
+			victim = ivictim(other);
+			release(&other->lock);
+		}
+		if(victim == 0)
+			panic("iget: no inodes");
+		acquire(&bk->lock);
+
+		// someone may have cached the inode meanwhile.
+		for(ip = bk->head.next; ip != &bk->head; ip = ip->next) {
+			if(ip->dev == dev && ip->inum == inum) {
+				ip->ref++;
+				victim->inum = 0;
+				ipush(bk, victim);
+				release(&bk->lock);
+				return ip;
+			}
+		}
 	}
 
-	// Recycle an inode cache entry.
-	if(empty == 0)
-		panic("iget: no inodes");
-
-	ip = empty;
+	ip = victim;
 	ip->dev = dev;
 	ip->inum = inum;
 	ip->ref = 1;
 	ip->valid = 0;
-	release(&icache.lock);
+	ipush(bk, ip);
+	release(&bk->lock);
 
 	return ip;
 }
@@ -292,9 +451,11 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-	acquire(&icache.lock);
+	struct ibucket *bk = ibucketof(ip->dev, ip->inum);
+
+	acquire(&bk->lock);
 	ip->ref++;
-	release(&icache.lock);
+	release(&bk->lock);
 	return ip;
 }
 
@@ -322,6 +483,8 @@ ilock(struct inode *ip)
 		ip->size = dip->size;
 		memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
 		brelse(bp);
+		memset(ip->ext, 0, sizeof(ip->ext));
+		ip->lastblock = 0;
 		ip->valid = 1;
 		if(ip->type == 0)
 			panic("ilock: no type");
@@ -348,7 +511,9 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
-	acquire(&icache.lock);
+	struct ibucket *bk = ibucketof(ip->dev, ip->inum);
+
+	acquire(&bk->lock);
 
 	if(ip->ref == 1 && ip->valid && ip->nlink == 0) {
 		// inode has no links and no other references: truncate and free.
@@ -357,8 +522,10 @@ iput(struct inode *ip)
 		// so this acquiresleep() won't block (or deadlock).
 		acquiresleep(&ip->lock);
 
-		release(&icache.lock);
+		release(&bk->lock);
 
+		if(ip->type == T_DIR)
+			dcpurge(ip);
 		itrunc(ip);
 		ip->type = 0;
 		iupdate(ip);
@@ -366,11 +533,16 @@ iput(struct inode *ip)
 
 		releasesleep(&ip->lock);
 
-		acquire(&icache.lock);
+		acquire(&bk->lock);
 	}
 
 	ip->ref--;
-	release(&icache.lock);
+	if(ip->ref == 0) {
+		// no one is using it.
+		iunlink(ip);
+		ipush(bk, ip);
+	}
+	release(&bk->lock);
 }
 
 // Common idiom: unlock, then put.
@@ -386,40 +558,232 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. The NDINDIRECT blocks
+// after that are listed in the indirect blocks listed in
+// the double-indirect block ip->addrs[NDIRECT+1].
+//
+// Since balloc() allocates each block of a file next to the
+// last one, a file's blocks are mostly consecutive on disk. Each lookup through an
+// indirect block caches the run of consecutive blocks it
+// falls in as an extent on the inode, so that sequential
+// access reads indirect blocks once per run, not per block.
+
+// The container whose disk quota ip's blocks count against.
+// A file's or directory's dinode.minor holds its owner's id
+// (see ownerid()). An owner whose slot has since been reused
+// is gone, and ireown() handed its blocks to root.
+static struct container*
+iowner(struct inode *ip)
+{
+	struct container *c;
+
+	if(ip->type == T_DEVICE || ip->minor < 0)
+		return &containers[0];
+	c = &containers[ip->minor % NCONTS];
+	if(ip->minor / NCONTS != c->diskgen)
+		return &containers[0];
+	return c;
+}
+
+// Generations of a slot that owner ids tell apart; they
+// wrap after that many reuses of one slot.
+#define OWNERGENS (32768 / NCONTS)
+
+// The owner id that ialloc() stores for files of c: its slot
+// and the slot's generation, so that ids aren't reused along
+// with slots.
+static int
+ownerid(struct container *c)
+{
+	return c->diskgen * NCONTS + (c - containers);
+}
+
+// Container slot c is being reused by a new container. Hand
+// the blocks still charged to the old one over to root, which
+// now owns its files, so the new container starts with none.
+void
+ireown(struct container *c)
+{
+	if(isroot(c))
+		return;
+	c->diskgen = (c->diskgen + 1) % OWNERGENS;
+	__sync_fetch_and_add(&containers[0].diskused,
+	                     __sync_lock_test_and_set(&c->diskused, 0));
+}
+
+// Charge a block to c, unless c is at its disklimit (root
+// has none). Atomic, so that concurrent allocations can't
+// overshoot the limit.
+static int
+dcharge(struct container *c)
+{
+	int used;
+
+	if(isroot(c)) {
+		__sync_fetch_and_add(&c->diskused, 1);
+		return 0;
+	}
+	do {
+		used = c->diskused;
+		if(used >= c->disklimit)
+			return -1;
+	} while(!__sync_bool_compare_and_swap(&c->diskused, used, used + 1));
+	return 0;
+}
+
+// Uncharge a block from c. Blocks allocated before boot were
+// never charged, so never go below zero.
+static void
+duncharge(struct container *c)
+{
+	int used;
+
+	do {
+		used = c->diskused;
+		if(used <= 0)
+			return;
+	} while(!__sync_bool_compare_and_swap(&c->diskused, used, used - 1));
+}
+
+// Allocate a block for ip, charged to its owner, just after
+// the last one allocated for it, if that is free, so that its
+// blocks stay together. Returns 0 if the disk or the owner's
+// quota is full.
+static uint
+balloci(struct inode *ip)
+{
+	struct container *c = iowner(ip);
+	uint addr;
+
+	if(dcharge(c) < 0)
+		return 0;
+	if((addr = balloc(ip->dev, ip->lastblock ? ip->lastblock + 1 : 0)) == 0) {
+		duncharge(c);
+		return 0;
+	}
+	ip->lastblock = addr;
+	return addr;
+}
+
+// Free a block of ip's, uncharging its owner.
+static void
+bfreei(struct inode *ip, uint b)
+{
+	bfree(ip->dev, b);
+	duncharge(iowner(ip));
+}
+
+// Look bn up in ip's extent cache; 0 if it isn't there.
+static uint
+extlookup(struct inode *ip, uint bn)
+{
+	struct extent *e;
+
+	for(e = ip->ext; e < ip->ext + NEXTENT; e++) {
+		if(bn - e->bn < e->len)
+			return e->addr + (bn - e->bn);
+	}
+	return 0;
+}
+
+// Cache the run of consecutive disk blocks starting at
+// a[i], in an indirect block of n entries; a[i] holds
+// file block bn.
+static void
+extadd(struct inode *ip, uint bn, uint *a, int i, int n)
+{
+	struct extent *e = &ip->ext[ip->extnext++ % NEXTENT];
+	int j;
+
+	for(j = i + 1; j < n && a[j] == a[i] + (j - i); j++)
+		;
+	e->bn = bn;
+	e->addr = a[i];
+	e->len = j - i;
+}
+
+// Return entry i of indirect block addr, allocating the
+// block it names if there is none; 0 if that fails.
+static uint
+indirect(struct inode *ip, uint addr, uint i, uint bn)
+{
+	struct buf *bp;
+	uint *a;
+
+	if(addr == 0)
+		return 0;
+	bp = bread(ip->dev, addr);
+	a = (uint*)bp->data;
+	if((addr = a[i]) == 0) {
+		if((a[i] = addr = balloci(ip)) != 0)
+			log_write(bp);
+	} else if(bn != 0) {
+		extadd(ip, bn, a, i, NINDIRECT);
+	}
+	brelse(bp);
+	return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one; returns 0
+// if the disk or ip's owner's disk quota is full.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-	uint addr, *a;
-	struct buf *bp;
+	uint addr;
 
 	if(bn < NDIRECT) {
 		if((addr = ip->addrs[bn]) == 0)
-			ip->addrs[bn] = addr = balloc(ip->dev);
+			ip->addrs[bn] = addr = balloci(ip);
 		return addr;
 	}
+	if((addr = extlookup(ip, bn)) != 0)
+		return addr;
 	bn -= NDIRECT;
 
 	if(bn < NINDIRECT) {
 		// Load indirect block, allocating if necessary.
 		if((addr = ip->addrs[NDIRECT]) == 0)
-			ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-		bp = bread(ip->dev, addr);
-		a = (uint*)bp->data;
-		if((addr = a[bn]) == 0) {
-			a[bn] = addr = balloc(ip->dev);
-			log_write(bp);
-		}
-		brelse(bp);
-		return addr;
+			ip->addrs[NDIRECT] = addr = balloci(ip);
+		return indirect(ip, addr, bn, NDIRECT + bn);
+	}
+	bn -= NINDIRECT;
+
+	if(bn < NDINDIRECT) {
+		// Load double-indirect block, then the indirect
+		// block it lists, allocating if necessary.
+		if((addr = ip->addrs[NDIRECT+1]) == 0)
+			ip->addrs[NDIRECT+1] = addr = balloci(ip);
+		addr = indirect(ip, addr, bn / NINDIRECT, 0);
+		return indirect(ip, addr, bn % NINDIRECT, NDIRECT + NINDIRECT + bn);
 	}
 
 	panic("bmap: out of range");
 }
 
+// Free indirect block addr and the blocks it lists,
+// and, if depth > 1, the blocks those list in turn.
+static void
+ifree(struct inode *ip, uint addr, int depth)
+{
+	struct buf *bp;
+	uint *a;
+	int j;
+
+	bp = bread(ip->dev, addr);
+	a = (uint*)bp->data;
+	for(j = 0; j < NINDIRECT; j++) {
+		if(a[j] == 0)
+			continue;
+		if(depth > 1)
+			ifree(ip, a[j], depth - 1);
+		else
+			bfreei(ip, a[j]);
+	}
+	brelse(bp);
+	bfreei(ip, addr);
+}
+
 // Truncate inode (discard contents).
 // Only called when the inode has no links
 // to it (no directory entries referring to it)
@@ -428,29 +792,26 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-	int i, j;
-	struct buf *bp;
-	uint *a;
+	int i;
 
 	for(i = 0; i < NDIRECT; i++) {
 		if(ip->addrs[i]) {
-			bfree(ip->dev, ip->addrs[i]);
+			bfreei(ip, ip->addrs[i]);
 			ip->addrs[i] = 0;
 		}
 	}
 
 	if(ip->addrs[NDIRECT]) {
-		bp = bread(ip->dev, ip->addrs[NDIRECT]);
-		a = (uint*)bp->data;
-		for(j = 0; j < NINDIRECT; j++) {
-			if(a[j])
-				bfree(ip->dev, a[j]);
-		}
-		brelse(bp);
-		bfree(ip->dev, ip->addrs[NDIRECT]);
+		ifree(ip, ip->addrs[NDIRECT], 1);
 		ip->addrs[NDIRECT] = 0;
 	}
 
+	if(ip->addrs[NDIRECT+1]) {
+		ifree(ip, ip->addrs[NDIRECT+1], 2);
+		ip->addrs[NDIRECT+1] = 0;
+	}
+
+	memset(ip->ext, 0, sizeof(ip->ext));
 	ip->size = 0;
 	iupdate(ip);
 }
@@ -494,14 +855,41 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 	return n;
 }
 
+// Start reading the blocks holding bytes off..off+n-1 of ip
+// into the buffer cache, without waiting for them.
+// Caller must hold ip->lock.
+void
+readahead(struct inode *ip, uint off, uint n)
+{
+	uint blocks[RAMAX], bn, nb;
+	int i;
+
+	if(off >= ip->size || n == 0)
+		return;
+	if(n > ip->size - off)
+		n = ip->size - off;
+	bn = off / BSIZE;
+	nb = (off + n - 1) / BSIZE + 1;
+	n = nb - bn;
+	while(n > 0) {
+		for(i = 0; i < RAMAX && i < n; i++)
+			blocks[i] = bmap(ip, bn + i);
+		breadahead(ip->dev, blocks, i);
+		bn += i;
+		n -= i;
+	}
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
 // otherwise, src is a kernel address.
+// Returns the number of bytes written, which is short if the
+// disk or the owner's disk quota fills up; -1 if none were.
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
-	uint tot, m;
+	uint tot, m, addr;
 	struct buf *bp;
 
 	if(off > ip->size || off + n < off)
@@ -510,7 +898,9 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 		return -1;
 
 	for(tot=0; tot<n; tot+=m, off+=m, src+=m) {
-		bp = bread(ip->dev, bmap(ip, off/BSIZE));
+		if((addr = bmap(ip, off/BSIZE)) == 0)
+			break;  // out of disk space
+		bp = bread(ip->dev, addr);
 		m = min(n - tot, BSIZE - off%BSIZE);
 		if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
 			brelse(bp);
@@ -529,7 +919,9 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 		iupdate(ip);
 	}
 
-	return n;
+	if(tot == 0 && n > 0)
+		return -1;
+	return tot;
 }
 
 // Directories
@@ -540,13 +932,391 @@ namecmp(const char *s, const char *t)
 	return strncmp(s, t, DIRSIZ);
 }
 
+// Directory entry cache.
+//
+// Remembers the results of recent dirlookup()s, keyed by
+// directory and name: the entry's inum and offset, or inum 0
+// if the directory has no such entry. dirlink() and
+// dirunlink() keep it up to date, so that repeated lookups
+// of the same names skip scanning the directory. Entries are
+// only added or changed with the directory locked.
+// The cache is a hash table of NDCACHE/DCWAYS sets, each
+// of DCWAYS entries replaced round robin.
+#define DCWAYS 4
+#define NDSET (NDCACHE/DCWAYS)
+
+struct dentry {
+	uint dev;
+	uint dinum;                // Directory's inum; 0 if unused
+	char name[DIRSIZ];
+	uint inum;                 // 0 if name isn't in the directory
+	uint off;                  // Offset of its dirent
+};
+
+struct {
+	struct spinlock lock;
+	struct dentry set[NDSET][DCWAYS];
+	int next[NDSET];           // Next entry of each set to replace
+} dcache;
+
+static void
+dcinit(void)
+{
+	initlock(&dcache.lock, "dcache");
+}
+
+static int
+dchash(struct inode *dp, char *name)
+{
+	uint h = dp->dev * 31 + dp->inum;
+	int i;
+
+	for(i = 0; i < DIRSIZ && name[i]; i++)
+		h = h * 31 + name[i];
+	return h % NDSET;
+}
+
+// Caller must hold dcache.lock.
+static struct dentry*
+dcfind(int s, struct inode *dp, char *name)
+{
+	struct dentry *d;
+
+	for(d = dcache.set[s]; d < dcache.set[s] + DCWAYS; d++) {
+		if(d->dinum == dp->inum && d->dev == dp->dev && namecmp(name, d->name) == 0)
+			return d;
+	}
+	return 0;
+}
+
+// Look name up in the cache; returns -1 if it isn't there.
+static int
+dcget(struct inode *dp, char *name, uint *inum, uint *off)
+{
+	struct dentry *d;
+	int s = dchash(dp, name), r = -1;
+
+	acquire(&dcache.lock);
+	if((d = dcfind(s, dp, name)) != 0) {
+		*inum = d->inum;
+		*off = d->off;
+		r = 0;
+	}
+	release(&dcache.lock);
+	return r;
+}
+
+// Record that name is in dp at off, as inum,
+// or that it isn't in dp if inum is 0.
+static void
+dcput(struct inode *dp, char *name, uint inum, uint off)
+{
+	struct dentry *d;
+	int s = dchash(dp, name);
+
+	acquire(&dcache.lock);
+	if((d = dcfind(s, dp, name)) == 0) {
+		d = &dcache.set[s][dcache.next[s]];
+		dcache.next[s] = (dcache.next[s] + 1) % DCWAYS;
+		d->dev = dp->dev;
+		d->dinum = dp->inum;
+		strncpy(d->name, name, DIRSIZ);
+	}
+	d->inum = inum;
+	d->off = off;
+	release(&dcache.lock);
+}
+
+// Forget directory dp, which is being freed, since
+// its inum may be reused for a different directory.
+static void
+dcpurge(struct inode *dp)
+{
+	struct dentry *d;
+
+	acquire(&dcache.lock);
+	for(d = &dcache.set[0][0]; d < &dcache.set[NDSET][0]; d++) {
+		if(d->dinum == dp->inum && d->dev == dp->dev)
+			d->dinum = 0;
+	}
+	release(&dcache.lock);
+}
+
+// Scan the dirents in bytes [lo, hi) of directory dp for
+// name, or for an unused one if name is 0. Returns the
+// offset of the dirent and sets *inum, or returns -1.
+static int
+dirscan(struct inode *dp, char *name, uint lo, uint hi, uint *inum)
+{
+	struct buf *bp = 0;
+	struct dirent *de;
+	uint off;
+
+	for(off = lo; off < hi; off += sizeof(*de)) {
+		if(bp == 0 || off % BSIZE == 0) {
+			if(bp)
+				brelse(bp);
+			bp = bread(dp->dev, bmap(dp, off / BSIZE));
+		}
+		de = (struct dirent*)(bp->data + off % BSIZE);
+		if(name == 0 ? de->inum == 0 :
+		   de->inum != 0 && namecmp(name, de->name) == 0) {
+			if(inum)
+				*inum = de->inum;
+			brelse(bp);
+			return off;
+		}
+	}
+	if(bp)
+		brelse(bp);
+	return -1;
+}
+
+// Hashed directories.
+//
+// A directory that outgrows its first block is converted to
+// hashed form (see DIRHASHED in fs.h). Each leaf holds the
+// entries whose names hash into a range, so a lookup reads
+// just the index and one leaf. A full leaf is split in two
+// by hash, so inserts stay cheap as well. If the index fills
+// up, or a leaf's entries all hash alike, new entries spill
+// into any block with room, and lookups that miss in their
+// leaf go on to scan the whole directory. Small directories,
+// and big ones made before hashing, stay linear.
+
+static uint
+dirhash(char *name)
+{
+	uint h = 2166136261;
+	int i;
+
+	for(i = 0; i < DIRSIZ && name[i]; i++) {
+		h ^= (uchar)name[i];
+		h *= 16777619;
+	}
+	return h;
+}
+
+// Sort the n hashes hs[], and return the one nearest the
+// middle that splits them in two, or 0 if they're all equal.
+static uint
+dxmedian(uint *hs, int n)
+{
+	int i, j;
+	uint t;
+
+	for(i = 1; i < n; i++) {
+		for(j = i; j > 0 && hs[j-1] > hs[j]; j--) {
+			t = hs[j];
+			hs[j] = hs[j-1];
+			hs[j-1] = t;
+		}
+	}
+	for(i = n/2; i < n; i++) {
+		if(hs[i] != hs[i-1])
+			return hs[i];
+	}
+	for(i = n/2; i > 0; i--) {
+		if(hs[i] != hs[i-1])
+			return hs[i];
+	}
+	return 0;
+}
+
+// Return the leaf of hashed directory dp that holds
+// hash h, and set *spilled if entries may be elsewhere.
+static uint
+dxleaf(struct inode *dp, uint h, int *spilled)
+{
+	struct buf *bp;
+	struct dxentry *dx;
+	uint leaf;
+	int i, n;
+
+	bp = bread(dp->dev, bmap(dp, 0));
+	dx = (struct dxentry*)bp->data;
+	n = dx[0].hash;
+	for(i = 1; i < n && dx[i+1].hash <= h; i++)
+		;
+	leaf = dx[i].block;
+	if(spilled)
+		*spilled = dx[0].block;
+	brelse(bp);
+	return leaf;
+}
+
+static int
+dxlookup(struct inode *dp, char *name, uint *inum)
+{
+	uint leaf;
+	int off, spilled;
+
+	leaf = dxleaf(dp, dirhash(name), &spilled);
+	off = dirscan(dp, name, leaf*BSIZE, (leaf+1)*BSIZE, inum);
+	if(off < 0 && spilled)
+		off = dirscan(dp, name, BSIZE, dp->size, inum);
+	return off;
+}
+
+// Split the full leaf of hashed directory dp in two,
+// moving the entries with the higher hashes to a new leaf.
+static int
+dxsplit(struct inode *dp, uint leaf)
+{
+	struct buf *ib, *lb, *nb;
+	struct dxentry *dx;
+	struct dirent *de, *nde;
+	uint hs[NDIRENT], m, nleaf, addr;
+	int i, j, n;
+
+	ib = bread(dp->dev, bmap(dp, 0));
+	dx = (struct dxentry*)ib->data;
+	n = dx[0].hash;
+	nleaf = dp->size / BSIZE;
+	if(n >= NDX - 1) {
+		brelse(ib);
+		return -1;
+	}
+	lb = bread(dp->dev, bmap(dp, leaf));
+	de = (struct dirent*)lb->data;
+	for(i = 0; i < NDIRENT; i++)
+		hs[i] = dirhash(de[i].name);
+	// allocate the new leaf only once it's sure to be used,
+	// since a block past dp->size would stay charged.
+	if((m = dxmedian(hs, NDIRENT)) == 0 || (addr = bmap(dp, nleaf)) == 0) {
+		brelse(lb);
+		brelse(ib);
+		return -1;
+	}
+
+	nb = bread(dp->dev, addr);
+	nde = (struct dirent*)nb->data;
+	for(i = j = 0; i < NDIRENT; i++) {
+		if(dirhash(de[i].name) >= m) {
+			memmove(&nde[j++], &de[i], sizeof(de[i]));
+			memset(&de[i], 0, sizeof(de[i]));
+		}
+	}
+	log_write(nb);
+	brelse(nb);
+	log_write(lb);
+	brelse(lb);
+
+	for(i = n; dx[i].hash > m; i--)
+		memmove(&dx[i+1], &dx[i], sizeof(dx[i]));
+	memset(&dx[i+1], 0, sizeof(dx[i+1]));
+	dx[i+1].hash = m;
+	dx[i+1].block = nleaf;
+	dx[0].hash = n + 1;
+	log_write(ib);
+	brelse(ib);
+
+	dp->size = (nleaf + 1) * BSIZE;
+	iupdate(dp);
+	dcpurge(dp);  // entries have moved
+	return 0;
+}
+
+// Convert the full, one-block, linear directory dp to
+// hashed form: an index and two leaves.
+static int
+dxconvert(struct inode *dp)
+{
+	struct buf *ib, *lb[2];
+	struct dxentry *dx;
+	struct dirent *de, *lde[2];
+	uint hs[NDIRENT], m, addr[2];
+	int i, k, n[2];
+
+	ib = bread(dp->dev, bmap(dp, 0));
+	de = (struct dirent*)ib->data;
+	for(i = 0; i < NDIRENT; i++)
+		hs[i] = dirhash(de[i].name);
+	if((m = dxmedian(hs, NDIRENT)) == 0 || (addr[0] = bmap(dp, 1)) == 0) {
+		brelse(ib);
+		return -1;
+	}
+	if((addr[1] = bmap(dp, 2)) == 0) {
+		// give back the first leaf, which is past dp->size.
+		bfreei(dp, addr[0]);
+		dp->addrs[1] = 0;
+		brelse(ib);
+		return -1;
+	}
+
+	for(k = 0; k < 2; k++) {
+		lb[k] = bread(dp->dev, addr[k]);
+		lde[k] = (struct dirent*)lb[k]->data;
+		n[k] = 0;
+	}
+	for(i = 0; i < NDIRENT; i++) {
+		k = dirhash(de[i].name) >= m;
+		memmove(&lde[k][n[k]++], &de[i], sizeof(de[i]));
+	}
+	for(k = 0; k < 2; k++) {
+		log_write(lb[k]);
+		brelse(lb[k]);
+	}
+
+	memset(ib->data, 0, BSIZE);
+	dx = (struct dxentry*)ib->data;
+	dx[0].hash = 2;
+	dx[1].hash = 0;
+	dx[1].block = 1;
+	dx[2].hash = m;
+	dx[2].block = 2;
+	log_write(ib);
+	brelse(ib);
+
+	dp->size = 3 * BSIZE;
+	dp->major = DIRHASHED;
+	iupdate(dp);
+	dcpurge(dp);  // entries have moved
+	return 0;
+}
+
+// Find room for name in hashed directory dp; returns
+// the offset of an unused dirent, or -1 if out of space.
+static int
+dxlink(struct inode *dp, char *name)
+{
+	struct buf *bp;
+	uint h, leaf;
+	int off, tries;
+
+	h = dirhash(name);
+	for(tries = 0; tries < 2; tries++) {
+		leaf = dxleaf(dp, h, 0);
+		if((off = dirscan(dp, 0, leaf*BSIZE, (leaf+1)*BSIZE, 0)) >= 0)
+			return off;
+		if(dxsplit(dp, leaf) < 0)
+			break;
+	}
+
+	// Spill: use any unused dirent, adding a block if need be.
+	if((off = dirscan(dp, 0, BSIZE, dp->size, 0)) < 0) {
+		if(bmap(dp, dp->size / BSIZE) == 0)  // zeroed by balloc
+			return -1;
+		off = dp->size;
+		dp->size += BSIZE;
+		iupdate(dp);
+	}
+	bp = bread(dp->dev, bmap(dp, 0));
+	if(((struct dxentry*)bp->data)[0].block == 0) {
+		((struct dxentry*)bp->data)[0].block = 1;
+		log_write(bp);
+	}
+	brelse(bp);
+	return off;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
 	uint off, inum;
-	struct dirent de;
+	int r;
 
 	// printf("name: %s\n", name);
 	if (isroot(myproc()->container) == 0 && strncmp(name, "..", 2) == 0 && dp == mycont()->root) {
@@ -558,21 +1328,31 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 	if(dp->type != T_DIR)
 		panic("dirlookup not DIR");
 
-	for(off = 0; off < dp->size; off += sizeof(de)) {
-		if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-			panic("dirlookup read");
-		if(de.inum == 0)
-			continue;
-		if(namecmp(name, de.name) == 0) {
-			// entry matches path element
-			if(poff)
-				*poff = off;
-			inum = de.inum;
-			return iget(dp->dev, inum);
-		}
+	if(dcget(dp, name, &inum, &off) == 0) {
+		__sync_fetch_and_add(&kstats.dhits, 1);
+		if(inum == 0)
+			return 0;
+		if(poff)
+			*poff = off;
+		return iget(dp->dev, inum);
+	}
+	__sync_fetch_and_add(&kstats.dmisses, 1);
+
+	if(dp->major == DIRHASHED)
+		r = dxlookup(dp, name, &inum);
+	else
+		r = dirscan(dp, name, 0, dp->size, &inum);
+	if(r < 0) {
+		dcput(dp, name, 0, 0);
+		return 0;
 	}
 
-	return 0;
+	// entry matches path element
+	off = r;
+	if(poff)
+		*poff = off;
+	dcput(dp, name, inum, off);
+	return iget(dp->dev, inum);
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
@@ -589,22 +1369,41 @@ dirlink(struct inode *dp, char *name, uint inum)
 		return -1;
 	}
 
-	// Look for an empty dirent.
-	for(off = 0; off < dp->size; off += sizeof(de)) {
-		if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-			panic("dirlink read");
-		if(de.inum == 0)
-			break;
+	// Look for an empty dirent. A linear directory that
+	// has filled its first block becomes hashed.
+	if(dp->major == DIRHASHED)
+		off = dxlink(dp, name);
+	else if((off = dirscan(dp, 0, 0, dp->size, 0)) < 0) {
+		off = dp->size;
+		if(off == BSIZE && dxconvert(dp) == 0)
+			off = dxlink(dp, name);
 	}
+	if(off < 0)
+		return -1;
 
 	strncpy(de.name, name, DIRSIZ);
 	de.inum = inum;
 	if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-		panic("dirlink");
+		return -1;
+	dcput(dp, name, inum, off);
 
 	return 0;
 }
 
+// Remove the entry for name, at offset off, from the
+// directory dp. Caller must hold dp->lock.
+int
+dirunlink(struct inode *dp, char *name, uint off)
+{
+	struct dirent de;
+
+	memset(&de, 0, sizeof(de));
+	if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+		return -1;
+	dcput(dp, name, 0, 0);
+	return 0;
+}
+
 // Paths
 
 // Copy the next path element from path into name.
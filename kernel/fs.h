@@ -24,18 +24,19 @@ struct superblock {
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
 // On-disk inode structure
 struct dinode {
   short type;           // File type
-  short major;          // Major device number (T_DEVICE only)
-  short minor;          // Minor device number (T_DEVICE only)
+  short major;          // Major device number (T_DEVICE); DIRHASHED (T_DIR)
+  short minor;          // Minor device number (T_DEVICE); else owner's container
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses
 };
 
 // Inodes per block.
@@ -58,3 +59,22 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+#define NDIRENT (BSIZE / sizeof(struct dirent))
+
+// A hashed directory has dinode.major DIRHASHED. Its block 0
+// is an index of its other blocks, the leaves, sorted by the
+// lowest name hash each holds. Index records are dirent-sized
+// and start with a zero inum, so that programs reading the
+// directory as dirents skip them. Record 0 is a header.
+#define DIRHASHED 1
+
+struct dxentry {
+  ushort zero;     // Overlays dirent.inum; always 0
+  ushort pad;
+  uint hash;       // Lowest hash in leaf; in header, number of leaves
+  uint block;      // Leaf's block in the directory; in header, spilled?
+  uint pad2;
+};
+
+#define NDX (BSIZE / sizeof(struct dxentry))
+
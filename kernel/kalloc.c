@@ -1,6 +1,7 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates whole 4096-byte pages,
+// or physically contiguous runs of 2^order pages.
 
 #include "types.h"
 #include "param.h"
@@ -9,6 +10,7 @@
 #include "riscv.h"
 #include "defs.h"
 #include "proc.h"
+#include "kstat.h"
 
 
 void freerange(void *pa_start, void *pa_end);
@@ -16,82 +18,440 @@ void freerange(void *pa_start, void *pa_end);
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
+extern struct container containers[]; // proc.c
+
 struct run {
 	struct run *next;
+	struct run *prev;          // kmem lists only
 };
 
+// kmem is a buddy allocator. A free block of order k is 2^k
+// pages, aligned (relative to KERNBASE) to its size, and is
+// on kmem.free[k]. Larger blocks are split to satisfy smaller
+// requests; a freed block is merged with its buddy, the other
+// half of the order k+1 block it came from, if that is free.
 struct {
 	struct spinlock lock;
-	struct run *freelist;
+	struct run *free[MAXORDER+1];
 } kmem;
 
+// Each cpu caches up to KCACHE free pages, so that most
+// kalloc()s and kfree()s only take that cpu's lock. A cache
+// refills from, and drains to, kmem KBATCH pages at a time.
+#define KCACHE 64
+#define KBATCH 32
+
+struct kcache {
+	struct spinlock lock;
+	struct run *freelist;
+	int n;
+} kcache[NCPU];
+
+// Fill pages with junk on free and allocation, to catch
+// dangling references; build with KALLOC_JUNK=0 to skip it.
+#ifndef KALLOC_JUNK
+#define KALLOC_JUNK 1
+#endif
+
+// One entry per physical page. ref counts the page tables
+// mapping the page, so that pages shared copy-on-write by
+// fork are only freed when the last mapping goes away; owner
+// is the container charged for the page, which is uncharged
+// when it is freed, whichever process frees it.
+struct pageinfo {
+	int ref;                   // Updated atomically
+	int owner;                 // Index in containers[], or -1
+	char isfree;               // Head of a free block? kmem.lock
+	char order;                // If so, its order
+};
+
+#define PA2PG(pa) (&pages[((uint64)(pa) - KERNBASE) / PGSIZE])
+struct pageinfo pages[(PHYSTOP - KERNBASE) / PGSIZE];
+
+static void freepage(void *pa);
+
 void
 kinit()
 {
 	initlock(&kmem.lock, "kmem");
+	for(int i = 0; i < NCPU; i++)
+		initlock(&kcache[i].lock, "kcache");
 	freerange(end, (void*)PHYSTOP);
 }
 
+// Put r on kmem's list of free blocks of order k.
+// Caller must hold kmem.lock.
+static void
+buddypush(struct run *r, int k)
+{
+	struct pageinfo *pg = PA2PG(r);
+
+	pg->isfree = 1;
+	pg->order = k;
+	r->prev = 0;
+	r->next = kmem.free[k];
+	if(r->next)
+		r->next->prev = r;
+	kmem.free[k] = r;
+	kstats.buddyfree[k]++;
+}
+
+// Take r off kmem's list of free blocks of order k.
+// Caller must hold kmem.lock.
+static void
+buddyremove(struct run *r, int k)
+{
+	PA2PG(r)->isfree = 0;
+	if(r->prev)
+		r->prev->next = r->next;
+	else
+		kmem.free[k] = r->next;
+	if(r->next)
+		r->next->prev = r->prev;
+	kstats.buddyfree[k]--;
+}
+
+// Allocate a block of order k, splitting a larger one
+// if need be. Caller must hold kmem.lock.
+static struct run*
+buddyalloc(int k)
+{
+	struct run *r;
+	int j;
+
+	for(j = k; j <= MAXORDER && kmem.free[j] == 0; j++)
+		;
+	if(j > MAXORDER)
+		return 0;
+	r = kmem.free[j];
+	buddyremove(r, j);
+	while(j > k) {
+		j--;
+		buddypush((struct run*)((char*)r + (PGSIZE << j)), j);
+	}
+	kstats.buddyallocs[k]++;
+	return r;
+}
+
+// Free a block of order k, merging it with its buddy
+// for as long as that is free. Caller must hold kmem.lock.
+static void
+buddyfree(struct run *r, int k)
+{
+	struct run *b;
+	struct pageinfo *pg;
+
+	for(; k < MAXORDER; k++) {
+		// physical memory is a power-of-two size and
+		// alignment, so the buddy is always in range.
+		b = (struct run*)(KERNBASE + (((uint64)r - KERNBASE) ^ (PGSIZE << k)));
+		pg = PA2PG(b);
+		if(!pg->isfree || pg->order != k)
+			break;
+		buddyremove(b, k);
+		if(b < r)
+			r = b;
+	}
+	buddypush(r, k);
+}
+
 void
 freerange(void *pa_start, void *pa_end)
 {
 	char *p;
 	p = (char*)PGROUNDUP((uint64)pa_start);
+	acquire(&kmem.lock);
 	for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-		kfree(p);
+		buddyfree((struct run*)p, 0);
+	release(&kmem.lock);
 }
 
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Add a reference to a page, for another mapping of it.
+void
+kref(void *pa)
+{
+	if((uint64)pa < KERNBASE || (uint64)pa >= PHYSTOP)
+		panic("kref");
+	__sync_fetch_and_add(&PA2PG(pa)->ref, 1);
+}
+
+// Number of references to a page.
+int
+krefcnt(void *pa)
+{
+	return PA2PG(pa)->ref;
+}
+
+// Drop a reference to a page; returns 1 if it
+// is still in use and must not be freed.
+static int
+kunref(void *pa)
+{
+	if((uint64)pa < KERNBASE || (uint64)pa >= PHYSTOP)
+		panic("kfree");
+	return __sync_sub_and_fetch(&PA2PG(pa)->ref, 1) > 0;
+}
+
+// Drop a reference to the page of physical memory
+// pointed at by pa, which normally should have been
+// returned by a call to kalloc(), and free it if that
+// was the last. (The exception is when initializing
+// the allocator; see kinit above.)
 void
 kfree(void *pa)
+{
+	struct pageinfo *pg;
+
+	if(kunref(pa))
+		return;
+	pg = PA2PG(pa);
+	if(pg->owner >= 0) {
+		__sync_fetch_and_sub(&containers[pg->owner].memused, 1);
+		pg->owner = -1;
+	}
+	freepage(pa);
+}
+
+// Free a page from kalloc_kernel().
+void
+kfree_kernel(void *pa)
+{
+	if(kunref(pa))
+		return;
+	freepage(pa);
+}
+
+// Move KBATCH pages from a full cache to kmem.
+// Caller must hold kc->lock.
+static void
+kdrain(struct kcache *kc)
 {
 	struct run *r;
-	struct container *c;
-	if((long)(c = mycont()) != -1) {
-		// printf("free: %s\n", c->name);
-		c->memused--;
+
+	acquire(&kmem.lock);
+	for(int i = 0; i < KBATCH; i++) {
+		r = kc->freelist;
+		kc->freelist = r->next;
+		buddyfree(r, 0);
 	}
+	release(&kmem.lock);
+	kc->n -= KBATCH;
+}
+
+// Move up to KBATCH pages from kmem to an empty cache.
+// Caller must hold kc->lock.
+static void
+krefill(struct kcache *kc)
+{
+	struct run *r;
+
+	acquire(&kmem.lock);
+	while(kc->n < KBATCH && (r = buddyalloc(0)) != 0) {
+		r->next = kc->freelist;
+		kc->freelist = r;
+		kc->n++;
+	}
+	release(&kmem.lock);
+}
+
+// Take a page from another cpu's cache,
+// when kmem has run dry.
+static struct run*
+ksteal(struct kcache *self)
+{
+	struct kcache *kc;
+	struct run *r = 0;
+
+	for(kc = kcache; kc < &kcache[NCPU] && r == 0; kc++) {
+		if(kc == self)
+			continue;
+		acquire(&kc->lock);
+		if((r = kc->freelist) != 0) {
+			kc->freelist = r->next;
+			kc->n--;
+		}
+		release(&kc->lock);
+	}
+	return r;
+}
+
+static void
+freepage(void *pa)
+{
+	struct run *r;
+	struct kcache *kc;
+
 	if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
 		panic("kfree");
 
+#if KALLOC_JUNK
 	// Fill with junk to catch dangling refs.
 	memset(pa, 1, PGSIZE);
+#endif
 
 	r = (struct run*)pa;
 
-	acquire(&kmem.lock);
-	r->next = kmem.freelist;
-	kmem.freelist = r;
-	release(&kmem.lock);
+	push_off();
+	kc = &kcache[cpuid()];
+	acquire(&kc->lock);
+	r->next = kc->freelist;
+	kc->freelist = r;
+	if(++kc->n > KCACHE)
+		kdrain(kc);
+	release(&kc->lock);
+	pop_off();
+}
+
+// Charge n pages to c, unless that would take c over its
+// memlimit (root has none). Atomic, so that concurrent
+// allocations can't overshoot the limit.
+int
+charge(struct container *c, int n)
+{
+	int used;
+
+	if(isroot(c)) {
+		__sync_fetch_and_add(&c->memused, n);
+		return 0;
+	}
+	do {
+		used = c->memused;
+		if(used + n > c->memlimit)
+			return -1;
+	} while(!__sync_bool_compare_and_swap(&c->memused, used, used + n));
+	return 0;
+}
+
+// Undo charge(c, n).
+void
+uncharge(struct container *c, int n)
+{
+	__sync_fetch_and_sub(&c->memused, n);
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the  memory cannot be allocated.
+// The page is charged to the current process's container;
+// returns 0 if that would take it over its memlimit.
 void *
 kalloc(void)
 {
-	struct run *r;
 	struct proc *p;
-	if((long)(p = myproc()) != -1) {
-		struct container *c = p->container;
-		if (isroot(c) == 0 && c->memused >= c->memlimit) {
-			printf("kalloc: failed: container mem limit exceeded\n");
+	struct container *c = 0;
+	char *pa;
+
+	p = myproc();
+	if(p != 0 && (long)p != -1) {
+		c = p->container;
+		if(charge(c, 1) < 0)
 			return 0;
-		}
-		c->memused++;
 	}
+	if((pa = kalloc_kernel()) == 0) {
+		if(c)
+			uncharge(c, 1);
+		return 0;
+	}
+	if(c)
+		PA2PG(pa)->owner = c - containers;
+	return pa;
+}
+
+// Allocate a page for the kernel's own structures,
+// which no container is charged for.
+void *
+kalloc_kernel(void)
+{
+	struct run *r;
+	struct kcache *kc;
+
+	push_off();
+	kc = &kcache[cpuid()];
+	acquire(&kc->lock);
+	if(kc->n == 0)
+		krefill(kc);
+	if((r = kc->freelist) != 0) {
+		kc->freelist = r->next;
+		kc->n--;
+	}
+	release(&kc->lock);
+	if(r == 0)
+		r = ksteal(kc);
+	pop_off();
+
+	if(r) {
+#if KALLOC_JUNK
+		memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
+		PA2PG(r)->ref = 1;
+		PA2PG(r)->owner = -1;
+	}
+	return (void*)r;
+}
+
+// Allocate 2^order physically contiguous pages for the kernel,
+// not charged to any container.
+// Returns 0 if no block that large is free.
+void *
+kalloc_pages(int order)
+{
+	struct run *r;
+
+	if(order == 0)
+		return kalloc_kernel();
+	if(order < 0 || order > MAXORDER)
+		return 0;
 
 	acquire(&kmem.lock);
-	r = kmem.freelist;
-	if(r)
-		kmem.freelist = r->next;
+	r = buddyalloc(order);
 	release(&kmem.lock);
 
-	if(r)
-		memset((char*)r, 5, PGSIZE); // fill with junk
+	if(r) {
+#if KALLOC_JUNK
+		memset((char*)r, 5, PGSIZE << order); // fill with junk
+#endif
+		PA2PG(r)->ref = 1;
+		PA2PG(r)->owner = -1;
+	}
 	return (void*)r;
 }
+
+// Free a block from kalloc_pages(order).
+void
+kfree_pages(void *pa, int order)
+{
+	if(order == 0) {
+		kfree_kernel(pa);
+		return;
+	}
+	if(order < 0 || order > MAXORDER ||
+	   ((uint64)pa - KERNBASE) % (PGSIZE << order) != 0 ||
+	   (char*)pa < end || (uint64)pa >= PHYSTOP)
+		panic("kfree_pages");
+	if(kunref(pa))
+		return;
+
+#if KALLOC_JUNK
+	// Fill with junk to catch dangling refs.
+	memset(pa, 1, PGSIZE << order);
+#endif
+
+	acquire(&kmem.lock);
+	buddyfree((struct run*)pa, order);
+	release(&kmem.lock);
+}
+
+// Number of free pages.
+uint64
+kfreemem(void)
+{
+	uint64 n = 0;
+
+	acquire(&kmem.lock);
+	for(int k = 0; k <= MAXORDER; k++)
+		n += kstats.buddyfree[k] << k;
+	release(&kmem.lock);
+	for(int i = 0; i < NCPU; i++)
+		n += kcache[i].n;
+	return n;
+}
@@ -0,0 +1,23 @@
+// Kernel event counters, copied out by the kstat() system call.
+// Include param.h first.
+struct kstat {
+  uint64 wakeups;      // Calls to wakeup()
+  uint64 wakeupempty;  // Calls to wakeup() that found no sleeper
+  uint64 buddyfree[MAXORDER+1];   // Free blocks of each order
+  uint64 buddyallocs[MAXORDER+1]; // Allocations of each order since boot;
+                                  // order 0 counts pages moved to cpu caches
+  uint64 bhits;        // Buffer cache lookups that hit
+  uint64 bmisses;      // Buffer cache lookups that missed
+  uint64 nbuf;         // Buffers in the cache
+  uint64 bahead;       // Blocks read ahead
+  uint64 commits;      // Log transactions committed
+  uint64 logblocks;    // Blocks written to the log
+  uint64 dhits;        // Directory lookups answered by the dcache
+  uint64 dmisses;      // Directory lookups that scanned the directory
+  uint64 ihits;        // Inode cache lookups that hit
+  uint64 imisses;      // Inode cache lookups that missed
+  uint64 ninode;       // Inodes in the cache
+  uint64 utlbhits;     // User PTE lookups by copyin()/copyout() that hit
+  uint64 utlbmisses;   // User PTE lookups that walked the page table
+  uint64 tracedrops;   // Trace events lost to a full ring
+};
@@ -6,6 +6,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "kstat.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -22,29 +23,66 @@
 // sleeps until the last outstanding end_op() commits.
 //
 // The log is a physical re-do log containing disk blocks.
-// The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
+// The log area is split into two regions, and successive
+// commits alternate between them. A commit copies the
+// transaction's blocks into the region's snapshot buffers,
+// after which new FS system calls can start the next
+// transaction. The snapshot is then written to the region in
+// one batch, followed by the region's header, which is the
+// real commit; then the snapshot is written to the blocks'
+// home locations in the background. The next commit uses
+// the other region, so it need not wait for that install.
+// A region is reused once its install is done, after its
+// header has been erased.
+//
+// The on-disk format of each region:
+//   header block, containing LOGMAGIC, seq and block #s for block A, B, C, ...
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Recovery replays committed regions in seq order. A header
+// without LOGMAGIC, or with a count or block # out of range,
+// is taken to be empty: on an image made for the older
+// single-region log, region 1's header block held log data.
+// Such an image must have been shut down cleanly, since its
+// own header isn't understood either.
+
+#define LOGMAGIC 0x6c6f6732  // "log2"
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
+  int magic;
   int n;
+  int seq;
   int block[LOGSIZE];
 };
 
+// One of the two halves of the log, and the transaction
+// most recently committed to it.
+struct logregion {
+  int start;                 // block # of the header
+  int ondisk;                // header not yet erased?
+  int installing;            // snapshot blocks not yet home; log.lock
+  struct logheader lh;
+  struct buf snap[LOGSIZE];  // copies of the blocks, not in the cache
+  struct buf *home[LOGSIZE]; // the blocks, pinned in the cache
+};
+
 struct log {
   struct spinlock lock;
+  struct sleeplock commitlk; // keeps commits in seq order
   int start;
   int size;
+  int cap;         // most blocks in a transaction
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
   int dev;
+  int fssize;      // blocks in the file system
+  int seq;         // seq of the next commit
   struct logheader lh;
+  struct logregion region[2];
 };
 struct log log;
 
@@ -54,71 +92,127 @@ static void commit();
 void
 initlog(int dev, struct superblock *sb)
 {
+  struct logregion *rg;
+  char *data = 0;
+  int i;
+
   if (sizeof(struct logheader) >= BSIZE)
     panic("initlog: too big logheader");
 
   initlock(&log.lock, "log");
+  initsleeplock(&log.commitlk, "commit");
   log.start = sb->logstart;
   log.size = sb->nlog;
   log.dev = dev;
-  recover_from_log();
-}
+  log.fssize = sb->size;
+  log.cap = log.size/2 - 1;
+  if (log.cap > LOGSIZE)
+    log.cap = LOGSIZE;
+  if (log.cap < MAXOPBLOCKS)
+    panic("initlog: log too small");
 
-// Copy committed blocks from log to their home location
-static void
-install_trans(void)
-{
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  for (rg = log.region; rg < log.region+2; rg++) {
+    rg->start = log.start + (rg - log.region)*(log.size/2);
+    for (i = 0; i < log.cap; i++) {
+      if (i % (PGSIZE/BSIZE) == 0 && (data = kalloc_kernel()) == 0)
+        panic("initlog");
+      rg->snap[i].dev = dev;
+      rg->snap[i].data = (uchar*)data + (i % (PGSIZE/BSIZE))*BSIZE;
+    }
   }
+  recover_from_log();
 }
 
-// Read the log header from disk into the in-memory log header
+// Read a region's log header from disk into lh.
+// A header that isn't valid reads as empty.
 static void
-read_head(void)
+read_head(struct logregion *rg, struct logheader *lh)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
+  struct buf *buf = bread(log.dev, rg->start);
+  struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  lh->magic = LOGMAGIC;
+  lh->n = 0;
+  lh->seq = 0;
+  if (hb->magic == LOGMAGIC && hb->n >= 0 && hb->n <= log.cap) {
+    for (i = 0; i < hb->n; i++) {
+      if (hb->block[i] <= 0 || hb->block[i] >= log.fssize)
+        break;
+      lh->block[i] = hb->block[i];
+    }
+    if (i == hb->n) {
+      lh->n = hb->n;
+      lh->seq = hb->seq;
+    }
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Write a region's in-memory log header to disk.
+// This is the true point at which its transaction
+// commits.
 static void
-write_head(void)
+write_head(struct logregion *rg)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = bread(log.dev, rg->start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->magic = LOGMAGIC;
+  hb->n = rg->lh.n;
+  hb->seq = rg->lh.seq;
+  for (i = 0; i < rg->lh.n; i++) {
+    hb->block[i] = rg->lh.block[i];
   }
   bwrite(buf);
   brelse(buf);
+  rg->ondisk = rg->lh.n > 0;
+}
+
+// Copy the blocks of a region committed before a crash
+// from the log to their home locations, all at once.
+static void
+replay(struct logregion *rg)
+{
+  int tail;
+  struct buf *list = 0, **tailp = &list, *dbuf, *next;
+
+  for (tail = 0; tail < rg->lh.n; tail++) {
+    struct buf *lbuf = bread(log.dev, rg->start+tail+1); // read log block
+    dbuf = bread(log.dev, rg->lh.block[tail]); // read dst
+    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
+    brelse(lbuf);
+    dbuf->qnext = 0;
+    *tailp = dbuf;
+    tailp = &dbuf->qnext;
+  }
+  if (list)
+    bwritelist(list);  // write dsts to disk
+  for (dbuf = list; dbuf; dbuf = next) {
+    next = dbuf->qnext;
+    brelse(dbuf);
+  }
 }
 
 static void
 recover_from_log(void)
 {
-  read_head();
-  install_trans(); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  struct logregion *r0 = &log.region[0], *r1 = &log.region[1];
+
+  read_head(r0, &r0->lh);
+  read_head(r1, &r1->lh);
+  // if committed, copy from log to disk, oldest first.
+  if (r0->lh.n > 0 && r1->lh.n > 0 && r1->lh.seq < r0->lh.seq) {
+    replay(r1);
+    replay(r0);
+  } else {
+    replay(r0);
+    replay(r1);
+  }
+  log.seq = (r0->lh.seq > r1->lh.seq ? r0->lh.seq : r1->lh.seq) + 1;
+  r0->lh.n = 0;
+  write_head(r0); // clear the log
+  r1->lh.n = 0;
+  write_head(r1);
 }
 
 // called at the start of each FS system call.
@@ -129,7 +223,7 @@ begin_op(void)
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > log.cap){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
@@ -164,46 +258,124 @@ end_op(void)
 
   if(do_commit){
     // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
+    // to sleep with locks. commit() lets the next
+    // transaction begin once it has a copy of this one.
     commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy the transaction's modified blocks from the cache to
+// the region's snapshot. They stay pinned until installed.
 static void
-write_log(void)
+snapshot(struct logregion *rg)
 {
   int tail;
+  struct buf *b;
 
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+    b = bread(log.dev, log.lh.block[tail]); // pinned, so cached
+    memmove(rg->snap[tail].data, b->data, BSIZE);
+    rg->home[tail] = b;
+    brelse(b);
+    rg->lh.block[tail] = log.lh.block[tail];
+  }
+  rg->lh.n = log.lh.n;
+  rg->lh.seq = log.seq++;
+}
+
+// Write the snapshot to disk, at log block i if tolog,
+// else at its home location; link it for virtio_disk_submit().
+static void
+snapsubmit(struct logregion *rg, int tolog, void (*done)(struct buf*))
+{
+  int tail;
+  struct buf *b;
+
+  for (tail = 0; tail < rg->lh.n; tail++) {
+    b = &rg->snap[tail];
+    b->blockno = tolog ? rg->start+tail+1 : rg->lh.block[tail];
+    b->iodone = done;
+    b->qnext = tail+1 < rg->lh.n ? b+1 : 0;
   }
+  virtio_disk_submit(rg->snap, 1);
+}
+
+// Disk interrupt callback for a snapshot block written home:
+// unpin its cached copy, which can now be evicted.
+static void
+installed(struct buf *b)
+{
+  struct logregion *rg = &log.region[0];
+
+  if (b >= log.region[1].snap && b < log.region[1].snap+LOGSIZE)
+    rg = &log.region[1];
+  b->iodone = 0;
+  bunpin(rg->home[b - rg->snap]);
+
+  acquire(&log.lock);
+  if (--rg->installing == 0)
+    wakeup(rg);
+  release(&log.lock);
 }
 
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  struct logregion *rg, *other;
+  int tail, n;
+
+  acquiresleep(&log.commitlk);
+  rg = &log.region[log.seq % 2];
+  other = &log.region[(log.seq + 1) % 2];
+  n = log.lh.n;
+  if (n > 0) {
+    // the region's last install, two commits ago,
+    // must be done before its snapshot is reused.
+    acquire(&log.lock);
+    while (rg->installing > 0)
+      sleep(rg, &log.lock);
+    release(&log.lock);
+    snapshot(rg);
   }
+
+  // let the next transaction begin.
+  acquire(&log.lock);
+  log.lh.n = 0;
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
+
+  if (n > 0) {
+    if (rg->ondisk) {
+      // erase the region's old transaction before
+      // overwriting its blocks.
+      rg->lh.n = 0;
+      write_head(rg);
+      rg->lh.n = n;
+    }
+    snapsubmit(rg, 1, 0);  // Write the snapshot to the log
+    for (tail = 0; tail < rg->lh.n; tail++)
+      virtio_disk_wait(&rg->snap[tail]);
+    write_head(rg);    // Write header to disk -- the real commit
+    __sync_fetch_and_add(&kstats.commits, 1);
+    __sync_fetch_and_add(&kstats.logblocks, rg->lh.n);
+
+    // Now install writes to home locations, without waiting;
+    // but only once the other region's install is done, since
+    // the disk may reorder writes to a block both of them hold.
+    acquire(&log.lock);
+    while (other->installing > 0)
+      sleep(other, &log.lock);
+    rg->installing = rg->lh.n;
+    release(&log.lock);
+    snapsubmit(rg, 0, installed);
+  }
+  releasesleep(&log.commitlk);
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// commit() will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -215,7 +387,7 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.cap)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -232,4 +404,3 @@ log_write(struct buf *b)
   }
   release(&log.lock);
 }
-
@@ -27,6 +27,7 @@ main()
 		binit();     // buffer cache
 		iinit();     // inode cache
 		fileinit();  // file table
+		traceinit(); // system call tracing
 		virtio_disk_init(); // emulated hard disk
 		userinit();  // first user process
 
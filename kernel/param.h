@@ -1,15 +1,29 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC       512  // maximum number of processes
+#define NPINFO       32  // processes per psinfo() page
+#define MAXORDER     10  // largest kalloc_pages() block is 2^MAXORDER pages
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define PIPEPAGES     4  // default pipe buffer, in pages
+#define PIPEMAXPAGES 16  // largest pipe buffer, in pages
+#define NINODE       50  // minimum size of i-node cache
+#define ICACHEFRAC   64  // i-node cache gets an i-node per ICACHEFRAC free pages
+#define NDCACHE     256  // directory entry cache entries
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#ifndef LOGSIZE
+#define LOGSIZE      (MAXOPBLOCKS*12)  // blocks in on-disk log; at most 252
+#endif
+#define NBUF         (LOGSIZE*3+MAXOPBLOCKS)  // minimum size of disk block cache
+#define BCACHEFRAC   32  // disk block cache gets 1/BCACHEFRAC of free memory
+#define RAMIN         4  // initial readahead window, in blocks
+#define RAMAX        32  // largest readahead window, in blocks
 #define FSSIZE       200000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
 #define NCONS		 5 // maximum number of virtual consoles
 #define NCONTS		 5
+#define CSHARES   1024  // default container cpu weight
+#define CPERIOD     10  // container cpu quota period, in ticks
+#define XOOM        -9  // exit status of a process killed for want of memory
@@ -8,21 +8,39 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+// The buffer is 2^order pages from kalloc_pages(), so its
+// size is a power of two and nread/nwrite can wrap freely.
+// The buffer is charged to the container that made the pipe.
+// Bytes move in contiguous runs, one copyin()/copyout() per
+// run, and a sleeper is woken only when the buffer stops
+// being empty (readers) or full (writers).
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data;
+  uint size;      // bytes in data
+  int order;      // data is 2^order pages
+  struct container *cont;  // charged for data, or 0
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
 };
 
+// Make a pipe whose buffer holds npages pages, rounded up to
+// a power of two and at most PIPEMAXPAGES; 0 means PIPEPAGES.
 int
-pipealloc(struct file **f0, struct file **f1)
+pipealloc(struct file **f0, struct file **f1, int npages)
 {
   struct pipe *pi;
+  int order;
+
+  if(npages == 0)
+    npages = PIPEPAGES;
+  if(npages < 0 || npages > PIPEMAXPAGES)
+    return -1;
+  for(order = 0; (1 << order) < npages; order++)
+    ;
 
   pi = 0;
   *f0 = *f1 = 0;
@@ -30,6 +48,14 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((pi = (struct pipe*)kalloc()) == 0)
     goto bad;
+  pi->cont = 0;
+  if(charge(mycont(), 1 << order) < 0)
+    goto bad;
+  pi->cont = mycont();
+  if((pi->data = kalloc_pages(order)) == 0)
+    goto bad;
+  pi->order = order;
+  pi->size = PGSIZE << order;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
@@ -46,8 +72,11 @@ pipealloc(struct file **f0, struct file **f1)
   return 0;
 
  bad:
-  if(pi)
+  if(pi){
+    if(pi->cont)
+      uncharge(pi->cont, 1 << order);
     kfree((char*)pi);
+  }
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,6 +97,8 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
+    kfree_pages(pi->data, pi->order);
+    uncharge(pi->cont, 1 << pi->order);
     kfree((char*)pi);
   } else
     release(&pi->lock);
@@ -76,52 +107,62 @@ pipeclose(struct pipe *pi, int writable)
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
-  char ch;
+  int i, m, off;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
-  for(i = 0; i < n; i++){
-    while(pi->nwrite == pi->nread + PIPESIZE){  //DOC: pipewrite-full
-      if(pi->readopen == 0 || myproc()->killed){
+  for(i = 0; i < n; i += m){
+    while(pi->nwrite == pi->nread + pi->size){  //DOC: pipewrite-full
+      if(pi->readopen == 0 || pr->killed){
         release(&pi->lock);
-        return -1;
+        return i > 0 ? i : -1;
       }
-      wakeup(&pi->nread);
       sleep(&pi->nwrite, &pi->lock);
     }
-    if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+    // as much as fits before the end of the buffer.
+    off = pi->nwrite % pi->size;
+    m = pi->size - (pi->nwrite - pi->nread);
+    if(m > pi->size - off)
+      m = pi->size - off;
+    if(m > n - i)
+      m = n - i;
+    if(copyin(pr->pagetable, pi->data + off, addr + i, m) == -1)
       break;
-    pi->data[pi->nwrite++ % PIPESIZE] = ch;
+    if(pi->nwrite == pi->nread)
+      wakeup(&pi->nread);  // no longer empty
+    pi->nwrite += m;
   }
-  wakeup(&pi->nread);
   release(&pi->lock);
-  return n;
+  return i > 0 || n == 0 ? i : -1;
 }
 
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
+  int i, m, off;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
-    if(myproc()->killed){
+    if(pr->killed){
       release(&pi->lock);
       return -1;
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  for(i = 0; i < n && pi->nread != pi->nwrite; i += m){  //DOC: piperead-copy
+    off = pi->nread % pi->size;
+    m = pi->nwrite - pi->nread;
+    if(m > pi->size - off)
+      m = pi->size - off;
+    if(m > n - i)
+      m = n - i;
+    if(copyout(pr->pagetable, addr + i, pi->data + off, m) == -1)
       break;
+    if(pi->nwrite == pi->nread + pi->size)
+      wakeup(&pi->nwrite);  //DOC: piperead-wakeup; no longer full
+    pi->nread += m;
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
   return i;
 }
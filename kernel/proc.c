@@ -7,16 +7,47 @@
 #include "defs.h"
 #include "strings.h"
 #include "resumable.h"
+#include "kstat.h"
 
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
+// struct procs are carved out of whole pages as they are needed,
+// each with its own kernel stack, and are never given back (exit()
+// relies on a proc never being reused as anything else). ptab.all
+// lists every proc carved so far in slot order; it only grows at
+// the tail, so it can be walked without ptab.lock.
+struct {
+	struct spinlock lock;
+	struct proc *all;          // First proc carved
+	struct proc *last;         // Last proc carved
+	struct proc *free;         // UNUSED procs
+	int n;                     // Number carved, at most NPROC
+} ptab;
 
 struct container containers[NCONTS];
 
 struct container *root = &containers[0];
 
+// vruntime of the container picked most recently; a container
+// that has been idle is started from here, so it can't bank
+// cpu time while it has nothing to run.
+uint64 vruntime_min;
+
+// Sleeping processes hang on a hash table of wait queues
+// keyed by chan, so wakeup() only looks at processes sleeping
+// on channels that hash alike. A waitq's lock guards its list
+// and the SLEEPING -> RUNNABLE transition of the processes on
+// it; lock order is p->lock, then waitq lock, then runq lock.
+#define NWAITQ 64
+
+struct waitq {
+	struct spinlock lock;
+	struct proc *head;
+} waitq[NWAITQ];
+
+struct kstat kstats;
+
 struct proc *initproc;
 
 int nextpid = 1;
@@ -24,6 +55,12 @@ struct spinlock pid_lock;
 
 extern void forkret(void);
 static void wakeup1(struct proc *chan);
+static int wqdel(struct proc *p);
+static void runqput(struct proc *p);
+static void kick(int id);
+static struct container *pickcont(void);
+static void runqdel(struct proc *p);
+static void freeproc(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
 
@@ -38,6 +75,9 @@ loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz
 	if((va % PGSIZE) != 0)
 		panic("loadseg: va must be page aligned");
 
+	// get the whole segment on its way from the disk.
+	readahead(ip, offset, sz);
+
 	for(i = 0; i < sz; i += PGSIZE) {
 		pa = walkaddr(pagetable, va + i);
 		if(pa == 0)
@@ -56,15 +96,24 @@ loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz
 void
 procinit(void)
 {
-	struct proc *p;
 	struct container *c;
+	struct cpu *cpu;
 	initlock(&pid_lock, "nextpid");
+	initlock(&ptab.lock, "ptab");
+
+	for(cpu = cpus; cpu < &cpus[NCPU]; cpu++)
+		for(int i = 0; i < NCONTS; i++)
+			initlock(&cpu->runq[i].lock, "runq");
+
+	for(int i = 0; i < NWAITQ; i++)
+		initlock(&waitq[i].lock, "waitq");
 
 	for(c = &containers[0]; c < &containers[NCONTS]; c++) {
 		c->state = CUNUSED;
 		c->nextvpid = 1;
 		c->maxproc = 5;
 		c->memused = 0;
+		c->shares = CSHARES;
 		initlock(&c->vpid_lock, "vpid");
 		initlock(&c->lock, "container");
 	}
@@ -73,22 +122,50 @@ procinit(void)
 	// strncpy(root->name, root_name, 16);
 	// root->state = CRUNNING;
 	// root->max_proc = NPROC;
+}
 
-	for(p = proc; p < &proc[NPROC]; p++) {
-		initlock(&p->lock, "proc");
+// Carve a fresh page into procs for ptab.free.
+// Caller must hold ptab.lock.
+// Returns 0 on success, -1 if out of memory or NPROC.
+static int
+procgrow(void)
+{
+	struct proc *p, *end;
+	char *page, *stack;
 
+	if(ptab.n >= NPROC || (page = kalloc_kernel()) == 0)
+		return -1;
+	memset(page, 0, PGSIZE);
+
+	end = (struct proc*)(page + PGSIZE) - 1;
+	for(p = (struct proc*)page; p <= end && ptab.n < NPROC; p++) {
 		// Allocate a page for the process's kernel stack.
 		// Map it high in memory, followed by an invalid
-		// guard page.
-		char *pa = kalloc();
-		if(pa == 0)
-			panic("kalloc");
-		uint64 va = KSTACK((int) (p - proc));
-		kvmmap(va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
-		p->kstack = va;
+		// guard page. kvminit() made the page-table pages.
+		if((stack = kalloc_kernel()) == 0)
+			break;
+		initlock(&p->lock, "proc");
+		p->slot = ptab.n++;
+		p->kstack = KSTACK(p->slot);
+		kvmmap(p->kstack, (uint64)stack, PGSIZE, PTE_R | PTE_W);
+		p->freenext = ptab.free;
+		ptab.free = p;
+
+		// publish p only once it is initialized.
+		__sync_synchronize();
+		if(ptab.last)
+			ptab.last->allnext = p;
+		else
+			ptab.all = p;
+		ptab.last = p;
 	}
+	sfence_vma();
 
-	kvminithart();
+	if(p == (struct proc*)page) {
+		kfree_kernel(page);
+		return -1;
+	}
+	return 0;
 }
 
 // Must be called with interrupts disabled,
@@ -137,7 +214,7 @@ int
 numproc(struct container *c){
 	struct proc *p;
 	int count = 0;
-	for(p = proc; p < &proc[NPROC]; p++) {
+	for(p = ptab.all; p; p = p->allnext) {
 		if (p->state != UNUSED && p->container == c) {
 			count++;
 		}
@@ -167,7 +244,8 @@ int allocvpid(struct container *c){
 	return pid;
 }
 
-// Look in the process table for an UNUSED proc.
+// Take an UNUSED proc off the free list, carving more
+// if there are none.
 // If found, initialize state required to run in the kernel,
 // and return with p->lock held.
 // If there are no free procs, return 0.
@@ -176,27 +254,29 @@ allocproc(void)
 {
 	struct proc *p;
 
-	for(p = proc; p < &proc[NPROC]; p++) {
-		acquire(&p->lock);
-		if(p->state == UNUSED) {
-			goto found;
-		} else {
-			release(&p->lock);
-		}
+	acquire(&ptab.lock);
+	if(ptab.free == 0 && procgrow() < 0) {
+		release(&ptab.lock);
+		return 0;
 	}
-	return 0;
+	p = ptab.free;
+	ptab.free = p->freenext;
+	release(&ptab.lock);
 
-found:
+	acquire(&p->lock);
 	p->pid = allocpid();
+	p->cpu = cpuid();
 
 	// Allocate a trapframe page.
 	if((p->tf = (struct trapframe *)kalloc()) == 0) {
+		freeproc(p);
 		release(&p->lock);
 		return 0;
 	}
 
 	// An empty user page table.
 	p->pagetable = proc_pagetable(p);
+	utlbflush(p);
 
 	// Set up new context to start executing at forkret,
 	// which returns to user space.
@@ -222,10 +302,18 @@ freeproc(struct proc *p)
 	p->pid = 0;
 	p->parent = 0;
 	p->name[0] = 0;
+	wqdel(p);  // cstop() frees sleeping processes
+	traceset(p, 0);  // nor do they get to exit(); see cstop()
 	p->chan = 0;
 	p->killed = 0;
 	p->xstate = 0;
+	runqdel(p);
 	p->state = UNUSED;
+
+	acquire(&ptab.lock);
+	p->freenext = ptab.free;
+	ptab.free = p;
+	release(&ptab.lock);
 }
 
 // Create a page table for a given process,
@@ -302,6 +390,11 @@ userinit(void)
 	release(&p->lock);
 
 	cinit(p, "root", "/", NPROC, 256, 256);
+
+	// p has a container now, so it can be queued.
+	acquire(&p->lock);
+	runqput(p);
+	release(&p->lock);
 }
 
 // Grow or shrink user memory by n bytes.
@@ -309,14 +402,19 @@ userinit(void)
 int
 growproc(int n)
 {
-	uint sz;
+	uint64 sz;
 	struct proc *p = myproc();
 
 	sz = p->sz;
 	if(n > 0) {
-		if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
+		// only reserve the address space; pages are
+		// allocated as they are touched, see uvmlazy().
+		// don't reserve more than could ever be backed.
+		if(sz + n > PHYSTOP - KERNBASE)
 			return -1;
-		}
+		if(!isroot(p->container) && sz + n > (uint64)p->container->memlimit * PGSIZE)
+			return -1;
+		sz += n;
 	} else if(n < 0) {
 		sz = uvmdealloc(p->pagetable, sz, sz + n);
 	}
@@ -365,8 +463,6 @@ fork(void)
 
 	pid = np->pid;
 
-	np->state = RUNNABLE;
-
 	struct container *c = p->container;
 
 	// If exceed maxproc
@@ -380,6 +476,9 @@ fork(void)
 	np->container = c;
 	np->vpid = allocvpid(c);
 
+	np->state = RUNNABLE;
+	runqput(np);
+
 	release(&np->lock);
 
 	return pid;
@@ -392,7 +491,7 @@ reparent(struct proc *p)
 {
 	struct proc *pp;
 
-	for(pp = proc; pp < &proc[NPROC]; pp++) {
+	for(pp = ptab.all; pp; pp = pp->allnext) {
 		// this code uses pp->parent without holding pp->lock.
 		// acquiring the lock first could cause a deadlock
 		// if pp or a child of pp were also in exit()
@@ -422,6 +521,9 @@ exit(int status)
 	if(p == initproc)
 		panic("init exiting");
 
+	if(p->strace)
+		traceexit(p, status);
+
 	// Close all open files.
 	for(int fd = 0; fd < NOFILE; fd++) {
 		if(p->ofile[fd]) {
@@ -493,7 +595,7 @@ wait(uint64 addr)
 	for(;;) {
 		// Scan through table looking for exited children.
 		havekids = 0;
-		for(np = proc; np < &proc[NPROC]; np++) {
+		for(np = ptab.all; np; np = np->allnext) {
 			// this code uses np->parent without holding np->lock.
 			// acquiring the lock first would cause a deadlock,
 			// since np might be an ancestor, and we already hold p->lock.
@@ -538,19 +640,218 @@ unsigned int rand(int rand_max)
 	return rand;
 }
 
+// Append p to the queue of the cpu it last ran on, so that
+// it tends to stay where its cache state is.
+// Caller must have made p RUNNABLE while holding p->lock, or
+// for a process woken from sleep, the lock of its wait queue.
+static void
+runqput(struct proc *p)
+{
+	struct runq *rq;
+
+	if(p->rq)
+		return;
+	rq = &cpus[p->cpu].runq[p->container - containers];
+	acquire(&rq->lock);
+	p->rqnext = 0;
+	p->rqprev = rq->tail;
+	if(rq->tail)
+		rq->tail->rqnext = p;
+	else
+		rq->head = p;
+	rq->tail = p;
+	p->rq = rq;
+	release(&rq->lock);
+
+	// pairs with the fence in idle(): either that cpu sees p
+	// on its recheck, or we see it idle and wake it.
+	__sync_synchronize();
+	kick(p->cpu);
+}
 
-int
-get_next_active_container(int index){
-	for(;;) {
-		index = (index + 1) % NCONTS;
-		if (containers[index].state == CRUNNING) {
-			return index;
+// Send an inter-processor interrupt to hart id.
+// timervec clears it; it only serves to end a wfi.
+static void
+ipi(int id)
+{
+	*(volatile uint32*)CLINT_MSIP(id) = 1;
+}
+
+// Wake an idle cpu to run newly queued work,
+// preferring the one whose queue it is on.
+static void
+kick(int id)
+{
+	int i;
+
+	if(cpus[id].idle){
+		if(id != cpuid())
+			ipi(id);
+		return;
+	}
+	for(i = 0; i < NCPU; i++){
+		if(i != cpuid() && cpus[i].idle){
+			ipi(i);
+			return;
 		}
+	}
+}
+
+// Nothing is runnable: stall in wfi until an interrupt
+// arrives rather than spinning on the run queues.
+static void
+idle(struct cpu *cpu)
+{
+	cpu->idle = 1;
+	__sync_synchronize();
+	// recheck, in case work was queued before idle was set.
+	if(pickcont() == 0)
+		wfi();
+	cpu->idle = 0;
+}
 
+static void
+runqunlink(struct runq *rq, struct proc *p)
+{
+	if(p->rqprev)
+		p->rqprev->rqnext = p->rqnext;
+	else
+		rq->head = p->rqnext;
+	if(p->rqnext)
+		p->rqnext->rqprev = p->rqprev;
+	else
+		rq->tail = p->rqprev;
+	p->rqnext = p->rqprev = 0;
+	p->rq = 0;
+}
+
+// Take p off its run queue, if it is on one.
+// Caller must hold p->lock, so p can't be
+// put on another queue meanwhile.
+static void
+runqdel(struct proc *p)
+{
+	struct runq *rq = p->rq;
+
+	if(rq == 0)
+		return;
+	acquire(&rq->lock);
+	if(p->rq == rq)
+		runqunlink(rq, p);
+	release(&rq->lock);
+}
+
+// Dequeue the process at the head of rq, or return 0.
+// The caller must lock the process and check that it is
+// still RUNNABLE, since only the queue lock is held here.
+static struct proc*
+runqget(struct runq *rq)
+{
+	struct proc *p;
+
+	if(rq->head == 0)
+		return 0;
+	acquire(&rq->lock);
+	if((p = rq->head) != 0)
+		runqunlink(rq, p);
+	release(&rq->lock);
+	return p;
+}
+
+// Find a runnable process of container cindex, preferring
+// this cpu's own queue and otherwise stealing from the
+// other cpus, starting with our neighbour.
+static struct proc*
+pickproc(int cindex)
+{
+	struct proc *p;
+	int id = cpuid();
+
+	for(int i = 0; i < NCPU; i++) {
+		if((p = runqget(&cpus[(id + i) % NCPU].runq[cindex])) != 0)
+			return p;
 	}
 	return 0;
 }
 
+// Has c used up its cpu quota for the current period?
+static int
+throttled(struct container *c)
+{
+	return c->quota > 0 && c->period_used >= c->quota &&
+	       ticks - c->period_start < CPERIOD;
+}
+
+// Does any cpu have a runnable process of c queued?
+// Only a hint, since the queues are not locked.
+static int
+hasrunnable(struct container *c)
+{
+	int cindex = c - containers;
+
+	for(int i = 0; i < NCPU; i++)
+		if(cpus[i].runq[cindex].head)
+			return 1;
+	return 0;
+}
+
+// Choose the container to run next: among running containers
+// with runnable work and quota left, the one that has received
+// the least cpu time relative to its weight.
+static struct container*
+pickcont(void)
+{
+	struct container *c, *best = 0;
+	uint64 min, v, bestv = 0;
+
+	for(c = containers; c < &containers[NCONTS]; c++) {
+		if(c->state != CRUNNING || throttled(c) || !hasrunnable(c))
+			continue;
+		// c->lock, since cputick() charges vruntime under it.
+		min = __sync_fetch_and_add(&vruntime_min, 0);
+		acquire(&c->lock);
+		if(c->vruntime < min)
+			c->vruntime = min;
+		v = c->vruntime;
+		release(&c->lock);
+		if(best == 0 || v < bestv) {
+			best = c;
+			bestv = v;
+		}
+	}
+	// other cpus pick too; only ever move the minimum forward.
+	min = __sync_fetch_and_add(&vruntime_min, 0);
+	while(best && bestv > min) {
+		v = __sync_val_compare_and_swap(&vruntime_min, min, bestv);
+		if(v == min)
+			break;
+		min = v;
+	}
+	return best;
+}
+
+// Charge the current clock tick to the container of the
+// process running on this cpu. Called by every cpu on each
+// timer interrupt, with interrupts off.
+void
+cputick(void)
+{
+	struct proc *p = mycpu()->proc;
+	struct container *c;
+
+	if(p == 0)
+		return;
+	c = p->container;
+	acquire(&c->lock);
+	if(ticks - c->period_start >= CPERIOD) {
+		c->period_start = ticks;
+		c->period_used = 0;
+	}
+	c->period_used++;
+	c->cputicks++;
+	c->vruntime += (CSHARES << 10) / c->shares;
+	release(&c->lock);
+}
 
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
@@ -559,38 +860,49 @@ get_next_active_container(int index){
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
+// The container is chosen by weighted fair share (pickcont());
+// within it, processes come off per-cpu run queues, so picking
+// one costs O(NCPU) rather than a scan of every process.
+// With nothing to run, the cpu sleeps in wfi until a timer
+// interrupt or an ipi from runqput().
 void
 scheduler(void)
 {
 	struct proc *p;
+	struct container *c;
 	struct cpu *cpu = mycpu();
-	int cindex = get_next_active_container(0);
 
 	cpu->proc = 0;
 	for(;;) {
 		// Avoid deadlock by ensuring that devices can interrupt.
 		intr_on();
 
-		for(p = proc; p < &proc[NPROC]; p++) {
-			acquire(&p->lock);
-			if(p->state == RUNNABLE && p->container == &containers[cindex]) {
-				// Switch to chosen process.  It is the process's job
-				// to release its lock and then reacquire it
-				// before jumping back to us.
-				p->state = RUNNING;
-				cpu->proc = p;
-				swtch(&cpu->scheduler, &p->context);
-
-				// Process is done running for now.
-				// It should have changed its p->state before coming back.
-				cpu->proc = 0;
-				cindex = get_next_active_container(cindex);
-				// printf("running %s next\n", containers[cindex].name);
-			}
-			release(&p->lock);
+		p = 0;
+		if((c = pickcont()) != 0)
+			p = pickproc(c - containers);
+		if(p == 0){
+			idle(cpu);
+			continue;
 		}
-		cindex = get_next_active_container(cindex);
 
+		acquire(&p->lock);
+		if(p->state == RUNNABLE) {
+			// a racing kill() may have queued p again.
+			runqdel(p);
+
+			// Switch to chosen process.  It is the process's job
+			// to release its lock and then reacquire it
+			// before jumping back to us.
+			p->state = RUNNING;
+			p->cpu = cpuid();
+			cpu->proc = p;
+			swtch(&cpu->scheduler, &p->context);
+
+			// Process is done running for now.
+			// It should have changed its p->state before coming back.
+			cpu->proc = 0;
+		}
+		release(&p->lock);
 	}
 }
 
@@ -628,6 +940,7 @@ yield(void)
 	struct proc *p = myproc();
 	acquire(&p->lock);
 	p->state = RUNNABLE;
+	runqput(p);
 	sched();
 	release(&p->lock);
 }
@@ -653,27 +966,75 @@ forkret(void)
 	usertrapret();
 }
 
+static struct waitq*
+waitqof(void *chan)
+{
+	return &waitq[((uint64)chan * 0x9E3779B97F4A7C15ULL) >> 58];
+}
+
+// Caller must hold wq->lock.
+static void
+waitqunlink(struct waitq *wq, struct proc *p)
+{
+	if(p->wqprev)
+		p->wqprev->wqnext = p->wqnext;
+	else
+		wq->head = p->wqnext;
+	if(p->wqnext)
+		p->wqnext->wqprev = p->wqprev;
+	p->wqnext = p->wqprev = 0;
+}
+
+// Take p off its wait queue if it is sleeping.
+// Caller must hold p->lock, which keeps p->chan stable.
+// Returns 1 if p was asleep; p->state is left for the caller.
+static int
+wqdel(struct proc *p)
+{
+	struct waitq *wq;
+	int asleep = 0;
+
+	if(p->state != SLEEPING)
+		return 0;
+	wq = waitqof(p->chan);
+	acquire(&wq->lock);
+	if(p->state == SLEEPING) {
+		waitqunlink(wq, p);
+		asleep = 1;
+	}
+	release(&wq->lock);
+	return asleep;
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
 {
 	struct proc *p = myproc();
+	struct waitq *wq = waitqof(chan);
 
 	// Must acquire p->lock in order to
 	// change p->state and then call sched.
-	// Once we hold p->lock, we can be
-	// guaranteed that we won't miss any wakeup
-	// (wakeup locks p->lock),
-	// so it's okay to release lk.
 	if(lk != &p->lock) { //DOC: sleeplock0
 		acquire(&p->lock); //DOC: sleeplock1
-		release(lk);
 	}
 
-	// Go to sleep.
+	// Go to sleep. Once p is on the wait queue,
+	// we can be guaranteed that we won't miss any
+	// wakeup (wakeup locks the wait queue),
+	// so it's okay to release lk.
+	acquire(&wq->lock);
 	p->chan = chan;
 	p->state = SLEEPING;
+	p->wqprev = 0;
+	p->wqnext = wq->head;
+	if(wq->head)
+		wq->head->wqprev = p;
+	wq->head = p;
+	release(&wq->lock);
+	if(lk != &p->lock)
+		release(lk);
 
 	sched();
 
@@ -692,15 +1053,25 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
-	struct proc *p;
-
-	for(p = proc; p < &proc[NPROC]; p++) {
-		acquire(&p->lock);
-		if(p->state == SLEEPING && p->chan == chan) {
+	struct waitq *wq = waitqof(chan);
+	struct proc *p, *next;
+	int woke = 0;
+
+	acquire(&wq->lock);
+	for(p = wq->head; p; p = next) {
+		next = p->wqnext;
+		if(p->chan == chan) {
+			waitqunlink(wq, p);
 			p->state = RUNNABLE;
+			runqput(p);
+			woke = 1;
 		}
-		release(&p->lock);
 	}
+	release(&wq->lock);
+
+	__sync_fetch_and_add(&kstats.wakeups, 1);
+	if(!woke)
+		__sync_fetch_and_add(&kstats.wakeupempty, 1);
 }
 
 // Wake up p if it is sleeping in wait(); used by exit().
@@ -710,8 +1081,9 @@ wakeup1(struct proc *p)
 {
 	if(!holding(&p->lock))
 		panic("wakeup1");
-	if(p->chan == p && p->state == SLEEPING) {
+	if(p->chan == p && wqdel(p)) {
 		p->state = RUNNABLE;
+		runqput(p);
 	}
 }
 
@@ -723,7 +1095,7 @@ kill(int pid)
 {
 	struct proc *p;
 	struct container *c = mycont();
-	for(p = proc; p < &proc[NPROC]; p++) {
+	for(p = ptab.all; p; p = p->allnext) {
 
 		int proc_pid;
 		if (c == root) {
@@ -741,9 +1113,10 @@ kill(int pid)
 			}
 
 			p->killed = 1;
-			if(p->state == SLEEPING || p->state == SUSPENDED) {
+			if(wqdel(p) || p->state == SUSPENDED) {
 				// Wake process from sleep().
 				p->state = RUNNABLE;
+				runqput(p);
 			}
 			release(&p->lock);
 			return 0;
@@ -801,7 +1174,7 @@ procdump(void)
 	char *state;
 
 	printf("\n");
-	for(p = proc; p < &proc[NPROC]; p++) {
+	for(p = ptab.all; p; p = p->allnext) {
 		if(p->state == UNUSED)
 			continue;
 		if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
@@ -814,13 +1187,27 @@ procdump(void)
 }
 
 
+// Fill a ptable with up to NPINFO of c's processes (everyone's,
+// for root), starting at proc slot start. Sets *next to the slot
+// the following page starts at, or -1 if there are no more.
 struct ptable*
-ptableof(struct container *c, int *sz){
+ptableof(struct container *c, int start, int *sz, int *next){
 	struct proc *p;
 	int count = 0;
 	struct ptable *ptable = (struct ptable*)kalloc();
 
-	for(p = proc; p < &proc[NPROC]; p++) {
+	*next = -1;
+	if(ptable == 0) {
+		*sz = 0;
+		return 0;
+	}
+	for(p = ptab.all; p; p = p->allnext) {
+		if (p->slot < start)
+			continue;
+		if (count == NPINFO) {
+			*next = p->slot;
+			break;
+		}
 		acquire(&p->lock);
 		if (p->state != UNUSED && (c == root || p->container == c)) {
 
@@ -845,15 +1232,21 @@ ptableof(struct container *c, int *sz){
 	return ptable;
 }
 
+// Copy out one page of the process listing; see ptableof().
+// Returns the start of the next page, -1 if this is the last,
+// or -2 if nothing could be copied out.
 int
-psinfo(uint64 ptable_pt, uint64 count_pt)
+psinfo(uint64 ptable_pt, int start, uint64 count_pt)
 {
-	int sz;
-	struct ptable *ptable = ptableof(mycont(), &sz);
-	copyout(myproc()->pagetable, count_pt, (void*)&sz, sizeof(sz));
-	copyout(myproc()->pagetable, ptable_pt, (void*)ptable, sizeof(struct ptable));
+	int sz, next;
+	struct ptable *ptable = ptableof(mycont(), start, &sz, &next);
+	if (ptable == 0)
+		return -2;
+	if (copyout(myproc()->pagetable, count_pt, (void*)&sz, sizeof(sz)) < 0 ||
+	    copyout(myproc()->pagetable, ptable_pt, (void*)ptable, sizeof(struct ptable)) < 0)
+		next = -2;
 	kfree(ptable);
-	return 0;
+	return next;
 }
 
 
@@ -863,10 +1256,12 @@ suspend(int pid, struct file *f)
 	int found = 0;
 	struct proc *p;
 
-	for (p = proc; p < &proc[NPROC]; p++) {
+	for (p = ptab.all; p; p = p->allnext) {
 		acquire(&p->lock);
 		if (p->pid == pid) {
 			found = 1;
+			wqdel(p);
+			runqdel(p);
 			p->state = SUSPENDED;
 			release(&p->lock);
 
@@ -878,12 +1273,19 @@ suspend(int pid, struct file *f)
 			hdr.strace = p->strace;
 			strncpy(hdr.name, p->name, 16);
 			pagetable_t tmp = myproc()->pagetable;
+			uint64 tmpsz = myproc()->sz;
 			filewritefromkernel(f, (uint64) &hdr, sizeof(struct resumehdr));
 			filewritefromkernel(f, (uint64) p->tf, sizeof(struct trapframe));
+			// borrow p's address space, including its size, so
+			// that untouched heap in it faults in as zeroes.
 			myproc()->pagetable = p->pagetable;
+			myproc()->sz = p->sz;
+			utlbflush(myproc());
 			filewrite(f, (uint64) 0, hdr.code_sz);
 			filewrite(f, (uint64) (hdr.code_sz + PGSIZE), PGSIZE);
 			myproc()->pagetable = tmp;
+			myproc()->sz = tmpsz;
+			utlbflush(myproc());
 			break;
 		}
 		release(&p->lock);
@@ -967,8 +1369,10 @@ resume(char *filename){
 
 	// Restore proc struct and pagetable
 	p->sz = hdr.mem_sz;
-	p->strace = hdr.strace;
+	traceset(p, hdr.strace);
+	tracewake();
 	p->pagetable = pagetable;
+	utlbflush(p);
 
 	// Free old proc table
 	proc_freepagetable(oldpagetable, oldsz);
@@ -1009,9 +1413,16 @@ cinit(struct proc *p, char *name, char *root_dir, int max_proc, int max_page, in
 			c->state = CRUNNING;
 			c->maxproc = max_proc;
 			c->memlimit = max_page;
-			c->memused = 0;
+			// memused is left alone: pages of an earlier container
+			// in this slot stay charged until they are freed.
 			c->disklimit = max_disk;
-			c->diskused = 0;
+			ireown(c);  // files of an earlier container go to root
+			c->shares = CSHARES;
+			c->quota = 0;
+			c->period_used = 0;
+			c->period_start = ticks;
+			c->vruntime = __sync_fetch_and_add(&vruntime_min, 0);
+			c->cputicks = 0;
 			strncpy(c->root_dir, root_dir, strlen(root_dir));
 			p->vpid = allocvpid(c);
 			break;
@@ -1045,13 +1456,6 @@ cinfo(uint64 ctable_pt, uint64 count_pt)
 			default:
 				strncpy(ctable->containers[count].state, "UNKNOWN", 16); break;
 			}
-			int proc_sz;
-			struct ptable *ptable = ptableof(c, &proc_sz);
-
-			for(int i = 0; i < proc_sz; i++) {
-				ctable->containers[count].ptable.procs[i] = ptable->procs[i];
-			}
-			kfree(ptable);
 			ctable->containers[count].numproc = numproc(c);
 			ctable->containers[count].maxproc = c->maxproc;
 			// for(int i = 0; i < strlen(c->root_dir); i++) {
@@ -1063,6 +1467,9 @@ cinfo(uint64 ctable_pt, uint64 count_pt)
 			ctable->containers[count].memlimit = c->memlimit;
 			ctable->containers[count].diskused = c->diskused;
 			ctable->containers[count].disklimit = c->disklimit;
+			ctable->containers[count].shares = c->shares;
+			ctable->containers[count].quota = c->quota;
+			ctable->containers[count].cputicks = c->cputicks;
 			count++;
 		}
 		release(&c->lock);
@@ -1117,11 +1524,35 @@ cstop(char *name)
 		if (strncmp(c->name, name, strlen(name)) == 0) {
 			c->state = CUNUSED;
 			struct proc *p;
-			for (p = proc; p < &proc[NPROC]; p++) {
-				if (p->container == c) {
+			for (p = ptab.all; p; p = p->allnext) {
+				acquire(&p->lock);
+				if (p->state != UNUSED && p->container == c) {
 					freeproc(p);
 				}
+				release(&p->lock);
 			}
+			tracewake();  // for a reader of traced procs freed here
+			return 0;
+		}
+	}
+	return -1;
+}
+
+// Set the cpu weight and quota (ticks per CPERIOD,
+// 0 for none) of the named container.
+int
+csched(char *name, int shares, int quota)
+{
+	if (mycont() != root || shares <= 0 || quota < 0) {
+		return -1;
+	}
+	struct container *c;
+	for(c = containers; c < &containers[NCONTS]; c++) {
+		if (c->state != CUNUSED && strncmp(c->name, name, strlen(name)) == 0) {
+			acquire(&c->lock);
+			c->shares = shares;
+			c->quota = quota;
+			release(&c->lock);
 			return 0;
 		}
 	}
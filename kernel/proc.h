@@ -18,12 +18,23 @@ struct context {
 	uint64 s11;
 };
 
+// Queue of RUNNABLE processes, linked through p->rqnext/rqprev.
+struct runq {
+	struct spinlock lock;
+	struct proc *head;
+	struct proc *tail;
+};
+
 // Per-CPU state.
 struct cpu {
 	struct proc *proc;        // The process running on this cpu, or null.
 	struct context scheduler; // swtch() here to enter scheduler().
 	int noff;                 // Depth of push_off() nesting.
 	int intena;               // Were interrupts enabled before push_off()?
+	struct runq runq[NCONTS]; // RUNNABLE processes, one queue per container.
+	int idle;                 // Waiting in wfi for something to run?
+	uint64 utlbhits;          // uwalk() lookups that hit, for kstat()
+	uint64 utlbmisses;        // uwalk() lookups that walked
 };
 
 extern struct cpu cpus[NCPU];
@@ -82,6 +93,13 @@ struct trapframe {
 
 enum procstate { UNUSED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE, SUSPENDED };
 
+// A software TLB entry: a user page's leaf PTE; see uwalk() in vm.c.
+#define NUTLB 4
+struct utlb {
+	uint64 va;                 // page-aligned user address
+	pte_t *pte;                // its PTE in p->pagetable, or 0
+};
+
 // Per-process state
 struct proc {
 	struct spinlock lock;
@@ -98,6 +116,7 @@ struct proc {
 	uint64 kstack;             // Bottom of kernel stack for this process
 	uint64 sz;                 // Size of process memory (bytes)
 	pagetable_t pagetable;     // Page table
+	struct utlb utlb[NUTLB];   // Recently copied-to/from pages; utlbflush()
 	struct trapframe *tf;      // data page for trampoline.S
 	struct context context;    // swtch() here to run process
 	struct file *ofile[NOFILE]; // Open files
@@ -108,6 +127,20 @@ struct proc {
 	struct container *container; // Pointer to container
 	int vpid;
 
+	// run queue linkage; the runq's lock protects these.
+	struct runq *rq;           // Queue p is on, or 0
+	struct proc *rqnext;
+	struct proc *rqprev;
+	int cpu;                   // CPU p last ran on; p->lock
+
+	// wait queue linkage; the waitq's lock protects these.
+	struct proc *wqnext;
+	struct proc *wqprev;
+
+	// process table linkage; see ptab in proc.c.
+	struct proc *allnext;      // Next proc carved; set once
+	struct proc *freenext;     // Next UNUSED proc; ptab.lock
+	int slot;                  // Carve order; picks the kernel stack
 };
 
 struct proc_info {
@@ -119,8 +152,9 @@ struct proc_info {
 	char container[16];
 };
 
+// One page of psinfo() results.
 struct ptable {
-	struct proc_info procs[NPROC];
+	struct proc_info procs[NPINFO];
 };
 
 enum containerstate { CUNUSED, CSUSPENDED, CRUNNING };
@@ -139,7 +173,16 @@ struct container {
 	int memlimit;
 	int diskused;
 	int disklimit;
+	int diskgen;               // Bumped on reuse of the slot; see iowner()
 	enum containerstate state;
+
+	// cpu fair share; see pickcont() in proc.c.
+	int shares;                // Weight relative to CSHARES
+	int quota;                 // Ticks allowed per CPERIOD, 0 for no limit
+	int period_used;           // Ticks used in the current period
+	uint period_start;         // ticks when the current period began
+	uint64 vruntime;           // Ticks run, scaled by CSHARES/shares
+	int cputicks;              // Total ticks run
 };
 
 
@@ -153,8 +196,10 @@ struct container_info {
 	int memlimit;
 	int diskused;
 	int disklimit;
+	int shares;
+	int quota;
+	int cputicks;
 	char root[MAXPATH];
-	struct ptable ptable;
 };
 
 struct ctable {
@@ -312,6 +312,13 @@ r_ra()
   return x;
 }
 
+// stall until an interrupt is pending.
+static inline void
+wfi()
+{
+  asm volatile("wfi");
+}
+
 // flush the TLB.
 static inline void
 sfence_vma()
@@ -332,6 +339,7 @@ sfence_vma()
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // 1 -> user can access
+#define PTE_COW (1L << 8) // copy-on-write; RSW bit, ignored by hardware
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
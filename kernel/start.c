@@ -37,6 +37,9 @@ start()
   w_medeleg(0xffff);
   w_mideleg(0xffff);
 
+  // let supervisor mode read the time CSR, for tracing.
+  w_mcounteren(r_mcounteren() | 2);
+
   // ask for clock interrupts.
   timerinit();
 
@@ -66,9 +69,13 @@ timerinit()
   // scratch[0..3] : space for timervec to save registers.
   // scratch[4] : address of CLINT MTIMECMP register.
   // scratch[5] : desired interval (in cycles) between timer interrupts.
+  // scratch[6] : set by timervec on each timer interrupt, for devintr().
+  // scratch[7] : address of CLINT MSIP register, for ipis.
   uint64 *scratch = &mscratch0[32 * id];
   scratch[4] = CLINT_MTIMECMP(id);
   scratch[5] = interval;
+  scratch[6] = 0;
+  scratch[7] = CLINT_MSIP(id);
   w_mscratch((uint64)scratch);
 
   // set the machine-mode trap handler.
@@ -77,6 +84,6 @@ timerinit()
   // enable machine-mode interrupts.
   w_mstatus(r_mstatus() | MSTATUS_MIE);
 
-  // enable machine-mode timer interrupts.
-  w_mie(r_mie() | MIE_MTIE);
+  // enable machine-mode timer and software (ipi) interrupts.
+  w_mie(r_mie() | MIE_MTIE | MIE_MSIE);
 }
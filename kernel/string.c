@@ -1,13 +1,39 @@
 #include "types.h"
 
+// memset() and memmove() move 8-byte words, four at a time,
+// once the destination is word-aligned. RISC-V traps on
+// misaligned word accesses, so memmove() copies bytes
+// if src and dst are not aligned alike.
+#define WMASK (sizeof(uint64) - 1)
+
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uint64 w, *wdst;
+
+  while(n > 0 && ((uint64)cdst & WMASK)){
+    *cdst++ = c;
+    n--;
+  }
+  if(n >= sizeof(uint64)){
+    w = (uchar)c;
+    w |= w << 8;
+    w |= w << 16;
+    w |= w << 32;
+    wdst = (uint64 *) cdst;
+    for(; n >= 4*sizeof(uint64); n -= 4*sizeof(uint64), wdst += 4){
+      wdst[0] = w;
+      wdst[1] = w;
+      wdst[2] = w;
+      wdst[3] = w;
+    }
+    for(; n >= sizeof(uint64); n -= sizeof(uint64))
+      *wdst++ = w;
+    cdst = (char *) wdst;
   }
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -33,16 +59,59 @@ memmove(void *dst, const void *src, uint n)
   const char *s;
   char *d;
 
+  const uint64 *ws;
+  uint64 *wd;
+  int aligned;
+
   s = src;
   d = dst;
+  aligned = (((uint64)s ^ (uint64)d) & WMASK) == 0;
   if(s < d && s + n > d){
     s += n;
     d += n;
+    if(aligned){
+      while(n > 0 && ((uint64)d & WMASK)){
+        *--d = *--s;
+        n--;
+      }
+      ws = (const uint64 *) s;
+      wd = (uint64 *) d;
+      for(; n >= 4*sizeof(uint64); n -= 4*sizeof(uint64)){
+        wd -= 4, ws -= 4;
+        wd[3] = ws[3];
+        wd[2] = ws[2];
+        wd[1] = ws[1];
+        wd[0] = ws[0];
+      }
+      for(; n >= sizeof(uint64); n -= sizeof(uint64))
+        *--wd = *--ws;
+      s = (const char *) ws;
+      d = (char *) wd;
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    if(aligned){
+      while(n > 0 && ((uint64)d & WMASK)){
+        *d++ = *s++;
+        n--;
+      }
+      ws = (const uint64 *) s;
+      wd = (uint64 *) d;
+      for(; n >= 4*sizeof(uint64); n -= 4*sizeof(uint64), wd += 4, ws += 4){
+        wd[0] = ws[0];
+        wd[1] = ws[1];
+        wd[2] = ws[2];
+        wd[3] = ws[3];
+      }
+      for(; n >= sizeof(uint64); n -= sizeof(uint64))
+        *wd++ = *ws++;
+      s = (const char *) ws;
+      d = (char *) wd;
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
@@ -113,6 +113,10 @@ extern uint64 sys_cinit(void);
 extern uint64 sys_cpause(void);
 extern uint64 sys_cresume(void);
 extern uint64 sys_cstop(void);
+extern uint64 sys_csched(void);
+extern uint64 sys_kstat(void);
+extern uint64 sys_pipe2(void);
+extern uint64 sys_trace(void);
 
 
 
@@ -148,7 +152,11 @@ static uint64 (*syscalls[])(void) = {
 	[SYS_cinit]  sys_cinit,
 	[SYS_cpause]  sys_cpause,
 	[SYS_cresume]  sys_cresume,
-	[SYS_cstop]  sys_cstop
+	[SYS_cstop]  sys_cstop,
+	[SYS_csched]  sys_csched,
+	[SYS_kstat]   sys_kstat,
+	[SYS_pipe2]   sys_pipe2,
+	[SYS_trace]   sys_trace
 };
 
 void
@@ -159,7 +167,10 @@ syscall(void)
 
 	num = p->tf->a7;
 	if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
-		p->tf->a0 = syscalls[num]();
+		if(p->strace)
+			p->tf->a0 = tracecall(p, num, syscalls[num]);
+		else
+			p->tf->a0 = syscalls[num]();
 	} else {
 		printf("%d %s: unknown sys call %d\n",
 		       p->pid, p->name, num);
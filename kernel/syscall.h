@@ -29,3 +29,7 @@
 #define SYS_cpause  29
 #define SYS_cresume 30
 #define SYS_cstop   31
+#define SYS_csched  32
+#define SYS_kstat   33
+#define SYS_pipe2   34
+#define SYS_trace   35
@@ -58,13 +58,6 @@ sys_dup(void)
 	struct file *f;
 	int fd;
 
-	struct proc *curr_proc = myproc();
-	int fd_id;
-	argint(0, &fd_id);
-	if(curr_proc->strace == 1) {
-		printf("[%d] sys_dup(%d)\n", curr_proc->pid, fd_id);
-	}
-
 	if(argfd(0, 0, &f) < 0)
 		return -1;
 	if((fd=fdalloc(f)) < 0)
@@ -79,13 +72,6 @@ sys_read(void)
 	struct file *f;
 	int n;
 	uint64 p;
-	int fd;
-	argint(0, &fd);
-
-	struct proc *curr_proc = myproc();
-	if(curr_proc->strace == 1) {
-		printf("[%d] sys_read(%d, %p, %d)\n", curr_proc->pid, fd, p, n);
-	}
 
 	if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
 		return -1;
@@ -98,24 +84,9 @@ sys_write(void)
 	struct file *f;
 	int n;
 	uint64 p;
-	int fd;
-	argint(2, &n);
-	char str[n];
-	argint(0, &fd);
-	argstr(1, str, n);
-
-	char *buf = str;
-	struct proc *curr_proc = myproc();
-	if(curr_proc->strace == 1) {
-		if(*str == '\n') {
-			buf = "\\n";
-		}
-		printf("[%d] sys_write(%d, \"%s\", %d)\n", curr_proc->pid, fd, buf, n);
-	}
 
 	if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
 		return -1;
-
 	return filewrite(f, p, n);
 }
 
@@ -124,12 +95,8 @@ sys_close(void)
 {
 	int fd;
 	struct file *f;
-	int status = argfd(0, &fd, &f);
-	struct proc *curr_proc = myproc();
-	if(curr_proc->strace == 1) {
-		printf("[%d] sys_close(%d)\n", curr_proc->pid, fd);
-	}
-	if(status < 0)
+
+	if(argfd(0, &fd, &f) < 0)
 		return -1;
 	myproc()->ofile[fd] = 0;
 	fileclose(f);
@@ -142,12 +109,6 @@ sys_fstat(void)
 	struct file *f;
 	uint64 st; // user pointer to struct stat
 
-	int fd;
-	argint(0, &fd);
-	struct proc *curr_proc = myproc();
-	if(curr_proc->strace == 1) {
-		printf("[%d] sys_fstat(%d)\n", curr_proc->pid, fd);
-	}
 	if(argfd(0, 0, &f) < 0 || argaddr(1, &st) < 0)
 		return -1;
 	return filestat(f, st);
@@ -160,14 +121,7 @@ sys_link(void)
 	char name[DIRSIZ], new[MAXPATH], old[MAXPATH];
 	struct inode *dp, *ip;
 
-	int s1 = argstr(0, old, MAXPATH);
-	int s2 = argstr(1, new, MAXPATH);
-	struct proc *curr_proc = myproc();
-	if(curr_proc->strace == 1) {
-		printf("[%d] sys_link(\"%s\", \"%s\")\n", curr_proc->pid, old, new);
-	}
-
-	if(s1 < 0 || s2 < 0)
+	if(argstr(0, old, MAXPATH) < 0 || argstr(1, new, MAXPATH) < 0)
 		return -1;
 
 	begin_op();
@@ -211,16 +165,17 @@ bad:
 }
 
 // Is the directory dp empty except for "." and ".." ?
+// (In a hashed directory they needn't come first.)
 static int
 isdirempty(struct inode *dp)
 {
 	int off;
 	struct dirent de;
 
-	for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)) {
+	for(off=0; off<dp->size; off+=sizeof(de)) {
 		if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
 			panic("isdirempty: readi");
-		if(de.inum != 0)
+		if(de.inum != 0 && namecmp(de.name, ".") != 0 && namecmp(de.name, "..") != 0)
 			return 0;
 	}
 	return 1;
@@ -230,17 +185,10 @@ uint64
 sys_unlink(void)
 {
 	struct inode *ip, *dp;
-	struct dirent de;
 	char name[DIRSIZ], path[MAXPATH];
 	uint off;
 
-	int status = argstr(0, path, MAXPATH);
-	struct proc *curr_proc = myproc();
-	if(curr_proc->strace == 1) {
-		printf("[%d] sys_unlink(\"%s\")\n", curr_proc->pid, path);
-	}
-
-	if(status < 0)
+	if(argstr(0, path, MAXPATH) < 0)
 		return -1;
 
 	begin_op();
@@ -266,8 +214,7 @@ sys_unlink(void)
 		goto bad;
 	}
 
-	memset(&de, 0, sizeof(de));
-	if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+	if(dirunlink(dp, name, off) < 0)
 		panic("unlink: writei");
 	if(ip->type == T_DIR) {
 		dp->nlink--;
@@ -313,25 +260,37 @@ create(char *path, short type, short major, short minor)
 		panic("create: ialloc");
 
 	ilock(ip);
-	ip->major = major;
-	ip->minor = minor;
+	if(type == T_DEVICE) { // else minor is the owner; see ialloc()
+		ip->major = major;
+		ip->minor = minor;
+	}
 	ip->nlink = 1;
 	iupdate(ip);
 
 	if(type == T_DIR) { // Create . and .. entries.
-		dp->nlink++; // for ".."
-		iupdate(dp);
 		// No ip->nlink++ for ".": avoid cyclic ref count.
 		if(dirlink(ip, ".", ip->inum) < 0 || dirlink(ip, "..", dp->inum) < 0)
-			panic("create dots");
+			goto bad;
 	}
 
 	if(dirlink(dp, name, ip->inum) < 0)
-		panic("create: dirlink");
+		goto bad;
 
+	if(type == T_DIR) {
+		dp->nlink++; // for ".."
+		iupdate(dp);
+	}
 	iunlockput(dp);
 
 	return ip;
+
+bad:
+	// out of disk space: free ip.
+	ip->nlink = 0;
+	iupdate(ip);
+	iunlockput(ip);
+	iunlockput(dp);
+	return 0;
 }
 
 uint64
@@ -341,13 +300,8 @@ sys_open(void)
 	int fd, omode;
 	struct file *f;
 	struct inode *ip;
-	int n = argstr(0, path, MAXPATH);
-	int s2 = argint(1, &omode);
-	struct proc *curr_proc = myproc();
-	if(curr_proc->strace == 1) {
-		printf("[%d] sys_open(\"%s\", %d)\n", curr_proc->pid, path, omode);
-	}
-	if(n < 0 || s2 < 0)
+
+	if(argstr(0, path, MAXPATH) < 0 || argint(1, &omode) < 0)
 		return -1;
 
 	begin_op();
@@ -391,6 +345,9 @@ sys_open(void)
 	} else {
 		f->type = FD_INODE;
 		f->off = 0;
+		f->ranext = 0;
+		f->raend = 0;
+		f->rawin = 0;
 	}
 	f->ip = ip;
 	f->readable = !(omode & O_WRONLY);
@@ -407,14 +364,9 @@ sys_mkdir(void)
 {
 	char path[MAXPATH];
 	struct inode *ip;
-	int status = argstr(0, path, MAXPATH);
-	struct proc *curr_proc = myproc();
-	if(curr_proc->strace == 1) {
-		printf("[%d] sys_mkdir(\"%s\")\n", curr_proc->pid, path);
-	}
 
 	begin_op();
-	if(status < 0 || (ip = create(path, T_DIR, 0, 0)) == 0) {
+	if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0) {
 		end_op();
 		return -1;
 	}
@@ -430,18 +382,10 @@ sys_mknod(void)
 	char path[MAXPATH];
 	int major, minor;
 
-	int s1 = argint(1, &major);
-	int s2 = argint(2, &minor);
-	int s3 = argstr(0, path, MAXPATH);
-
-	struct proc *curr_proc = myproc();
-	if(curr_proc->strace == 1) {
-		printf("[%d] sys_mknod(\"%s\", %d, %d)\n", curr_proc->pid, path, major, minor);
-	}
 	begin_op();
-	if(s1 < 0 ||
-	   s2 < 0 ||
-	   s3 < 0 ||
+	if(argstr(0, path, MAXPATH) < 0 ||
+	   argint(1, &major) < 0 ||
+	   argint(2, &minor) < 0 ||
 	   (ip = create(path, T_DEVICE, major, minor)) == 0) {
 		end_op();
 		return -1;
@@ -457,13 +401,9 @@ sys_chdir(void)
 	char path[MAXPATH];
 	struct inode *ip;
 	struct proc *p = myproc();
-	int status = argstr(0, path, MAXPATH);
-	struct proc *curr_proc = myproc();
-	if(curr_proc->strace == 1) {
-		printf("[%d] sys_chdir(%s)\n", curr_proc->pid, path);
-	}
+
 	begin_op();
-	if(status < 0 || (ip = namei(path)) == 0) {
+	if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0) {
 		end_op();
 		return -1;
 	}
@@ -486,17 +426,8 @@ sys_exec(void)
 	char path[MAXPATH], *argv[MAXARG];
 	int i;
 	uint64 uargv, uarg;
-	char str[MAXPATH];
-	argstr(1, str, MAXPATH);
-
-	struct proc *curr_proc = myproc();
-	int s1 = argstr(0, path, MAXPATH);
-	int s2 = argaddr(1, &uargv);
-	char *buf = str;
-	if(curr_proc->strace == 1) {
-		printf("[%d] sys_exec(\"%s\", \"%s\")\n", curr_proc->pid, path, buf);
-	}
-	if(s1 < 0 || s2 < 0) {
+
+	if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0) {
 		return -1;
 	}
 	memset(argv, 0, sizeof(argv));
@@ -532,21 +463,16 @@ bad:
 	return -1;
 }
 
-uint64
-sys_pipe(void)
+// Make a pipe with an npages-page buffer and store its
+// read and write fds at user address fdarray.
+static int
+pipefds(uint64 fdarray, int npages)
 {
-	uint64 fdarray; // user pointer to array of two integers
 	struct file *rf, *wf;
 	int fd0, fd1;
 	struct proc *p = myproc();
-	int status = argaddr(0, &fdarray);
 
-	if(p->strace == 1) {
-		printf("[%d] sys_pipe(%d)\n", p->pid, fdarray);
-	}
-	if(status < 0)
-		return -1;
-	if(pipealloc(&rf, &wf) < 0)
+	if(pipealloc(&rf, &wf, npages) < 0)
 		return -1;
 	fd0 = -1;
 	if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0) {
@@ -567,12 +493,31 @@ sys_pipe(void)
 	return 0;
 }
 
+uint64
+sys_pipe(void)
+{
+	uint64 fdarray; // user pointer to array of two integers
+
+	if(argaddr(0, &fdarray) < 0)
+		return -1;
+	return pipefds(fdarray, 0);
+}
+
+// Like pipe(), but with a buffer of npages pages.
+uint64
+sys_pipe2(void)
+{
+	uint64 fdarray; // user pointer to array of two integers
+	int npages;
+
+	if(argaddr(0, &fdarray) < 0 || argint(1, &npages) < 0 || npages <= 0)
+		return -1;
+	return pipefds(fdarray, npages);
+}
+
 uint64
 sys_traceon(void){
-	struct proc *p = myproc();
-	if (p->strace == 0) {
-		p->strace = 1;
-	}
+	traceset(myproc(), 1);
 	return 0;
 }
 
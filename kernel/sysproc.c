@@ -6,17 +6,13 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "kstat.h"
 
 uint64
 sys_exit(void)
 {
 	int n;
-	struct proc *curr_proc = myproc();
-	if(curr_proc->strace == 1) {
-		printf("[%d] sys_exit(%d)\n", curr_proc->pid, n);
-	}
-	int status = argint(0, &n);
-	if(status < 0)
+	if(argint(0, &n) < 0)
 		return -1;
 	exit(n);
 	return 0; // not reached
@@ -25,30 +21,18 @@ sys_exit(void)
 uint64
 sys_getpid(void)
 {
-	struct proc *curr_proc = myproc();
-	if(curr_proc->strace == 1) {
-		printf("[%d] sys_getpid()\n", curr_proc->pid);
-	}
 	return myproc()->pid;
 }
 
 uint64
 sys_fork(void)
 {
-	struct proc *curr_proc = myproc();
-	if(curr_proc->strace == 1) {
-		printf("[%d] sys_fork()\n", curr_proc->pid);
-	}
 	return fork();
 }
 
 uint64
 sys_wait(void)
 {
-	struct proc *curr_proc = myproc();
-	if(curr_proc->strace == 1) {
-		printf("[%d] sys_wait()\n", curr_proc->pid);
-	}
 	uint64 p;
 	if(argaddr(0, &p) < 0)
 		return -1;
@@ -60,12 +44,8 @@ sys_sbrk(void)
 {
 	int addr;
 	int n;
-	int status = argint(0, &n);
-	struct proc *curr_proc = myproc();
-	if(curr_proc->strace == 1) {
-		printf("[%d] sys_sbrk(%d)\n", curr_proc->pid, n);
-	}
-	if(status < 0)
+
+	if(argint(0, &n) < 0)
 		return -1;
 	addr = myproc()->sz;
 	if(growproc(n) < 0)
@@ -78,12 +58,8 @@ sys_sleep(void)
 {
 	int n;
 	uint ticks0;
-	int status = argint(0, &n);
-	struct proc *curr_proc = myproc();
-	if(curr_proc->strace == 1) {
-		printf("[%d] sys_sleep(%d)\n", curr_proc->pid, n);
-	}
-	if(status < 0)
+
+	if(argint(0, &n) < 0)
 		return -1;
 	acquire(&tickslock);
 	ticks0 = ticks;
@@ -102,12 +78,8 @@ uint64
 sys_kill(void)
 {
 	int pid;
-	int status = argint(0, &pid);
-	struct proc *curr_proc = myproc();
-	if(curr_proc->strace == 1) {
-		printf("[%d] sys_kill(%d)\n", curr_proc->pid, pid);
-	}
-	if(status < 0)
+
+	if(argint(0, &pid) < 0)
 		return -1;
 	return kill(pid);
 }
@@ -118,10 +90,7 @@ uint64
 sys_uptime(void)
 {
 	uint xticks;
-	struct proc *curr_proc = myproc();
-	if(curr_proc->strace == 1) {
-		printf("[%d] sys_uptime()\n", curr_proc->pid);
-	}
+
 	acquire(&tickslock);
 	xticks = ticks;
 	release(&tickslock);
@@ -133,11 +102,12 @@ sys_psinfo(void)
 {
 	uint64 ptable_pt;
 	uint64 count;
+	int start;
 	argaddr(0, &ptable_pt);
-	argaddr(1, &count);
+	argint(1, &start);
+	argaddr(2, &count);
 
-	psinfo(ptable_pt, count);
-	return 0;
+	return psinfo(ptable_pt, start, count);
 }
 
 uint64
@@ -191,3 +161,44 @@ sys_cstop(void)
 
 	return cstop(name);
 }
+
+uint64
+sys_csched(void)
+{
+	char name[16];
+	int shares, quota;
+	if(argstr(0, name, 16) < 0 || argint(1, &shares) < 0 || argint(2, &quota) < 0)
+		return -1;
+
+	return csched(name, shares, quota);
+}
+
+uint64
+sys_kstat(void)
+{
+	uint64 st; // user pointer to struct kstat
+	struct kstat k;
+	int i;
+
+	if(argaddr(0, &st) < 0)
+		return -1;
+	k = kstats;
+	k.utlbhits = k.utlbmisses = 0;
+	for(i = 0; i < NCPU; i++) {
+		k.utlbhits += cpus[i].utlbhits;
+		k.utlbmisses += cpus[i].utlbmisses;
+	}
+	return copyout(myproc()->pagetable, st, (char*)&k, sizeof(k));
+}
+
+// copy up to n trace events to the user's buffer.
+uint64
+sys_trace(void)
+{
+	uint64 buf;
+	int n;
+
+	if(argaddr(0, &buf) < 0 || argint(1, &n) < 0)
+		return -1;
+	return traceread(buf, n);
+}
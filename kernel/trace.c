@@ -0,0 +1,228 @@
+//
+// System call tracing.
+//
+// syscall() hands each call made by a process with tracing on
+// to tracecall(), which records its arguments, return value,
+// and duration as a struct traceevent. Events go into a ring
+// per CPU, written with interrupts off by the one CPU that
+// owns it, so a traced process never waits for a lock or for
+// the console; if a ring is full the event is dropped.
+// The trace() system call copies events out for strace to
+// format, sleeping until there are some; a new event wakes
+// it only if it is asleep, so the traced process takes
+// trace.lock once per sleep of the reader, not per event.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "syscall.h"
+#include "trace.h"
+#include "kstat.h"
+
+#define NTRACE 128  // events per CPU ring
+
+struct tracering {
+	struct traceevent ev[NTRACE];
+	uint head;  // events written; only its CPU changes it
+	uint tail;  // events read; trace.lock
+};
+
+struct {
+	struct spinlock lock;  // serializes readers
+	int live;              // processes with tracing on
+	int sleeping;          // readers asleep in traceread()
+	struct tracering ring[NCPU];
+} trace;
+
+void
+traceinit(void)
+{
+	initlock(&trace.lock, "trace");
+}
+
+// Wake up readers, if any are asleep. Taking trace.lock
+// makes sure a reader that found nothing to read is
+// asleep before the wakeup. Must be called without any
+// p->lock, as for wakeup().
+void
+tracewake(void)
+{
+	__sync_synchronize();  // the new event or live before sleeping
+	if(trace.sleeping) {
+		acquire(&trace.lock);
+		trace.sleeping = 0;  // wakes them all
+		wakeup(&trace);
+		release(&trace.lock);
+	}
+}
+
+// Are there events that no reader has taken?
+static int
+tracepending(void)
+{
+	int c;
+
+	for(c = 0; c < NCPU; c++) {
+		if(trace.ring[c].tail != trace.ring[c].head)
+			return 1;
+	}
+	return 0;
+}
+
+// Append ev to this CPU's ring.
+static void
+record(struct traceevent *ev)
+{
+	struct tracering *r;
+
+	push_off();
+	ev->cpu = cpuid();
+	r = &trace.ring[ev->cpu];
+	if(r->head - r->tail < NTRACE) {
+		r->ev[r->head % NTRACE] = *ev;
+		__sync_synchronize();  // the event before the new head
+		r->head++;
+	} else {
+		__sync_fetch_and_add(&kstats.tracedrops, 1);
+	}
+	pop_off();
+	tracewake();
+}
+
+// Turn tracing of p on or off. After turning it off, call
+// tracewake(), so a reader can see that it may be done.
+void
+traceset(struct proc *p, int on)
+{
+	on = (on != 0);
+	if(p->strace == on)
+		return;
+	p->strace = on;
+	__sync_fetch_and_add(&trace.live, on ? 1 : -1);
+}
+
+// Start an event for system call num by p.
+static void
+tracebegin(struct proc *p, int num, struct traceevent *ev)
+{
+	char *args = num < NELEM(sysdescs) ? sysdescs[num].args : 0;
+	uint64 addr, len;
+	int i;
+
+	memset(ev, 0, sizeof(*ev));
+	ev->pid = p->pid;
+	ev->num = num;
+	for(i = 0; i < NELEM(ev->arg); i++)
+		argaddr(i, &ev->arg[i]);
+	for(i = 0; args && args[i]; i++) {
+		addr = ev->arg[i];
+		if(args[i] == 's') {
+			// a string longer than TRACESTR is cut short.
+			copyinstr(p->pagetable, ev->str, addr, sizeof(ev->str));
+			break;
+		}
+		if(args[i] == 'b') {
+			len = ev->arg[i+1];
+			if(len > sizeof(ev->str))
+				len = sizeof(ev->str);
+			if(copyin(p->pagetable, ev->str, addr, len) < 0)
+				ev->str[0] = 0;
+			break;
+		}
+	}
+	ev->str[sizeof(ev->str)-1] = 0;
+	ev->start = r_time();
+}
+
+// Run system call num for p, which is being traced, and
+// record it.
+uint64
+tracecall(struct proc *p, int num, uint64 (*fn)(void))
+{
+	struct traceevent ev;
+
+	tracebegin(p, num, &ev);
+	ev.ret = fn();
+	ev.time = r_time() - ev.start;
+	record(&ev);
+	return ev.ret;
+}
+
+// p, which is being traced, is exiting, perhaps because it
+// was killed. Record that as an exit() call, the last event
+// of p, and stop tracing it.
+void
+traceexit(struct proc *p, int status)
+{
+	struct traceevent ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.pid = p->pid;
+	ev.num = SYS_exit;
+	ev.arg[0] = status;
+	ev.start = r_time();
+	record(&ev);
+	traceset(p, 0);
+	tracewake();
+}
+
+// Copy up to n events to user address addr, oldest first
+// within each CPU, waiting until there are some. Returns
+// how many, or -1 if there are none and no process is being
+// traced, so none will come.
+int
+traceread(uint64 addr, int n)
+{
+	struct traceevent *buf;
+	struct tracering *r;
+	int c, i, live;
+
+	if(n > PGSIZE / sizeof(struct traceevent))
+		n = PGSIZE / sizeof(struct traceevent);
+	if(n <= 0 || (buf = kalloc_kernel()) == 0)
+		return -1;
+
+	acquire(&trace.lock);
+	for(;;) {
+		// an exiting process records its last event before it
+		// stops being live, so if live was 0 here, the event
+		// will be seen below.
+		live = __sync_fetch_and_add(&trace.live, 0);
+
+		for(i = 0, c = 0; c < NCPU && i < n; c++) {
+			r = &trace.ring[c];
+			while(i < n && r->tail != r->head) {
+				__sync_synchronize();  // the head before the event
+				buf[i++] = r->ev[r->tail % NTRACE];
+				__sync_synchronize();  // the event before the new tail
+				r->tail++;
+			}
+		}
+		if(i > 0 || live == 0 || myproc()->killed)
+			break;
+
+		// count this reader as asleep only now, so that events
+		// don't take trace.lock while it is busy; then look
+		// again for any event or exit that came before it
+		// would have seen the count.
+		trace.sleeping++;
+		__sync_synchronize();  // sleeping before the rings and live
+		if(!tracepending() && __sync_fetch_and_add(&trace.live, 0) != 0)
+			sleep(&trace, &trace.lock);  // tracewake() uncounts it
+		else
+			trace.sleeping--;
+	}
+	release(&trace.lock);
+
+	if(i > 0 && copyout(myproc()->pagetable, addr, (char*)buf, i * sizeof(*buf)) < 0)
+		i = -1;
+	else if(i == 0)  // none will come, or killed
+		i = -1;
+	kfree_kernel(buf);
+	return i;
+}
@@ -0,0 +1,64 @@
+// System call trace events, recorded by syscall() for
+// processes that called traceon(), and read back by the
+// trace() system call. Include syscall.h first.
+
+#define TRACESTR  32  // bytes of a string argument kept
+#define TIMERHZ   10000000  // rate of the time CSR under qemu
+
+struct traceevent {
+  int pid;
+  short num;            // system call number
+  short cpu;            // CPU it finished on
+  uint64 arg[6];        // raw arguments
+  uint64 ret;           // return value
+  uint64 start;         // time CSR at entry
+  uint64 time;          // time CSR ticks spent in the call
+  char str[TRACESTR];   // the first 's' or 'b' argument
+};
+
+// How to record and print each system call: its name,
+// then a character per argument: 'd' an int, 'p' an
+// address, 's' a string, 'b' a buffer whose length is
+// the next argument. The first 's' or 'b' is copied
+// into the event when the call is made.
+struct sysdesc {
+  char *name;
+  char *args;
+};
+
+static struct sysdesc sysdescs[] = {
+[SYS_fork]    { "fork",    "" },
+[SYS_exit]    { "exit",    "d" },
+[SYS_wait]    { "wait",    "p" },
+[SYS_pipe]    { "pipe",    "p" },
+[SYS_read]    { "read",    "dpd" },
+[SYS_kill]    { "kill",    "d" },
+[SYS_exec]    { "exec",    "sp" },
+[SYS_fstat]   { "fstat",   "dp" },
+[SYS_chdir]   { "chdir",   "s" },
+[SYS_dup]     { "dup",     "d" },
+[SYS_getpid]  { "getpid",  "" },
+[SYS_sbrk]    { "sbrk",    "d" },
+[SYS_sleep]   { "sleep",   "d" },
+[SYS_uptime]  { "uptime",  "" },
+[SYS_open]    { "open",    "sd" },
+[SYS_write]   { "write",   "dbd" },
+[SYS_mknod]   { "mknod",   "sdd" },
+[SYS_unlink]  { "unlink",  "s" },
+[SYS_link]    { "link",    "sp" },
+[SYS_mkdir]   { "mkdir",   "s" },
+[SYS_close]   { "close",   "d" },
+[SYS_traceon] { "traceon", "" },
+[SYS_psinfo]  { "psinfo",  "pdp" },
+[SYS_suspend] { "suspend", "dd" },
+[SYS_resume]  { "resume",  "s" },
+[SYS_cinfo]   { "cinfo",   "pp" },
+[SYS_cinit]   { "cinit",   "spddd" },
+[SYS_cpause]  { "cpause",  "s" },
+[SYS_cresume] { "cresume", "s" },
+[SYS_cstop]   { "cstop",   "s" },
+[SYS_csched]  { "csched",  "sdd" },
+[SYS_kstat]   { "kstat",   "p" },
+[SYS_pipe2]   { "pipe2",   "pd" },
+[SYS_trace]   { "trace",   "pd" },
+};
@@ -16,6 +16,8 @@ void kernelvec();
 
 extern int devintr();
 
+extern uint64 mscratch0[]; // start.c
+
 void
 trapinit(void)
 {
@@ -29,6 +31,21 @@ trapinithart(void)
   w_stvec((uint64)kernelvec);
 }
 
+// A page fault at va: either the first touch of heap that
+// sbrk() reserved, or a store to a copy-on-write page.
+// Returns 0 if handled, -1 for a bad address, -2 if out of memory.
+static int
+pagefault(struct proc *p, uint64 va, int store)
+{
+  int r;
+
+  if((r = uvmlazy(p->pagetable, va, p->sz)) != -1)
+    return r;
+  if(store)
+    return uvmcow(p->pagetable, va);
+  return -1;
+}
+
 //
 // handle an interrupt, exception, or system call from user space.
 // called from trampoline.S
@@ -36,7 +53,7 @@ trapinithart(void)
 void
 usertrap(void)
 {
-  int which_dev = 0;
+  int which_dev = 0, err;
 
   if((r_sstatus() & SSTATUS_SPP) != 0)
     panic("usertrap: not from user mode");
@@ -65,6 +82,12 @@ usertrap(void)
     intr_on();
 
     syscall();
+  } else if((r_scause() == 13 || r_scause() == 15) &&
+            (err = pagefault(p, r_stval(), r_scause() == 15)) != -1){
+    // the page is in place now, unless the container (or the
+    // machine) is out of memory; then the process can't go on.
+    if(err == -2)
+      exit(XOOM);
   } else if((which_dev = devintr()) != 0){
     // ok
   } else {
@@ -194,17 +217,22 @@ devintr()
     plic_complete(irq);
     return 1;
   } else if(scause == 0x8000000000000001L){
-    // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // software interrupt from a machine-mode timer interrupt
+    // or an ipi, forwarded by timervec in kernelvec.S.
 
-    if(cpuid() == 0){
-      clockintr();
-    }
-    
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
     w_sip(r_sip() & ~2);
 
+    // an ipi only needs to wake the cpu from wfi.
+    if(__sync_lock_test_and_set(&mscratch0[32*cpuid() + 6], 0) == 0)
+      return 1;
+
+    if(cpuid() == 0){
+      clockintr();
+    }
+    cputick();
+
     return 2;
   } else {
     return 0;
@@ -27,9 +27,25 @@
 #define LCR 3 // line control register
 #define LSR 5 // line status register
 
+#define IER_RX_ENABLE (1<<0)
+#define IER_TX_ENABLE (1<<1)
+#define LSR_RX_READY (1<<0)   // input is waiting to be read from RHR
+#define LSR_TX_IDLE (1<<5)    // THR can accept another character to send
+
 #define ReadReg(reg) (*(Reg(reg)))
 #define WriteReg(reg, v) (*(Reg(reg)) = (v))
 
+// the transmit output buffer. uartstart() moves characters
+// from it to the UART whenever the UART can take one, and
+// the transmit-empty interrupt calls uartstart() again.
+struct spinlock uart_tx_lock;
+#define UART_TX_BUF_SIZE 512
+char uart_tx_buf[UART_TX_BUF_SIZE];
+uint64 uart_tx_w; // write next to uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE]
+uint64 uart_tx_r; // read next from uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE]
+
+static void uartstart(void);
+
 void
 uartinit(void)
 {
@@ -52,18 +68,84 @@ uartinit(void)
   // reset and enable FIFOs.
   WriteReg(FCR, 0x07);
 
-  // enable receive interrupts.
-  WriteReg(IER, 0x01);
+  // enable transmit and receive interrupts.
+  WriteReg(IER, IER_TX_ENABLE | IER_RX_ENABLE);
+
+  initlock(&uart_tx_lock, "uart");
+}
+
+// add n characters to the output buffer and tell the
+// UART to start sending if it isn't already. sleeps
+// while the buffer is full, so it must not be called
+// from interrupts; it's for use by write().
+void
+uartwrite(char *s, int n)
+{
+  int i;
+
+  acquire(&uart_tx_lock);
+  for(i = 0; i < n; i++){
+    while(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE){
+      // buffer is full; wait for uartstart()
+      // to open up space in the buffer.
+      sleep(&uart_tx_r, &uart_tx_lock);
+    }
+    uart_tx_buf[uart_tx_w++ % UART_TX_BUF_SIZE] = s[i];
+    if(uart_tx_w - uart_tx_r == UART_TX_BUF_SIZE)
+      uartstart();  // don't sleep on a buffer the UART isn't draining
+  }
+  uartstart();
+  release(&uart_tx_lock);
+}
+
+// throw away output not yet sent, e.g. when the console
+// it was written to is no longer the one being shown.
+void
+uartdiscard(void)
+{
+  acquire(&uart_tx_lock);
+  if(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE)
+    wakeup(&uart_tx_r);
+  uart_tx_r = uart_tx_w;
+  release(&uart_tx_lock);
 }
 
-// write one output character to the UART.
+// write one output character to the UART, without
+// using interrupts or the output buffer; for use by
+// kernel printf() and to echo characters. it spins
+// waiting for the UART's output register to be empty.
 void
 uartputc(int c)
 {
+  push_off();
   // wait for Transmit Holding Empty to be set in LSR.
-  while((ReadReg(LSR) & (1 << 5)) == 0)
+  while((ReadReg(LSR) & LSR_TX_IDLE) == 0)
     ;
   WriteReg(THR, c);
+  pop_off();
+}
+
+// if the UART is idle, and a character is waiting
+// in the transmit buffer, send it.
+// caller must hold uart_tx_lock.
+// called from both the top- and bottom-half.
+static void
+uartstart(void)
+{
+  int wasfull = uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE;
+
+  while(uart_tx_w != uart_tx_r){
+    if((ReadReg(LSR) & LSR_TX_IDLE) == 0){
+      // the UART transmit holding register is full,
+      // so we cannot give it another byte.
+      // it will interrupt when it's ready for a new byte.
+      break;
+    }
+    WriteReg(THR, uart_tx_buf[uart_tx_r++ % UART_TX_BUF_SIZE]);
+  }
+  // wake up uartwrite() only if it may be waiting.
+  if(wasfull && uart_tx_w != uart_tx_r + UART_TX_BUF_SIZE)
+    wakeup(&uart_tx_r);
 }
 
 // read one input character from the UART.
@@ -71,7 +153,7 @@ uartputc(int c)
 int
 uartgetc(void)
 {
-  if(ReadReg(LSR) & 0x01){
+  if(ReadReg(LSR) & LSR_RX_READY){
     // input data is ready.
     return ReadReg(RHR);
   } else {
@@ -79,14 +161,24 @@ uartgetc(void)
   }
 }
 
-// trap.c calls here when the uart interrupts.
+// handle a uart interrupt, raised because input has
+// arrived, or the uart is ready for more output, or
+// both. called from trap.c.
 void
 uartintr(void)
 {
+  ReadReg(ISR); // acknowledge the interrupt
+
+  // read and process incoming characters.
   while(1){
     int c = uartgetc();
     if(c == -1)
       break;
     consoleintr(c);
   }
+
+  // send buffered characters.
+  acquire(&uart_tx_lock);
+  uartstart();
+  release(&uart_tx_lock);
 }
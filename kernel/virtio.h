@@ -45,7 +45,8 @@
 
 // this many virtio descriptors.
 // must be a power of two.
-#define NUM 8
+#define NUM 32
+#define MAXSEG 8 // most blocks in one request
 
 struct VRingDesc {
   uint64 addr;
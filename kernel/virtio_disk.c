@@ -22,10 +22,8 @@
 
 static struct disk {
  // memory for virtio descriptors &c for queue 0.
- // this is a global instead of allocated because it must
- // be multiple contiguous pages, which kalloc()
- // doesn't support, and page aligned.
-  char pages[2*PGSIZE];
+ // two contiguous, page-aligned pages from kalloc_pages().
+  char *pages;
   struct VRingDesc *desc;
   uint16 *avail;
   struct UsedArea *used;
@@ -38,13 +36,23 @@ static struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b;   // first of n bufs, linked through qnext
+    int n;
     char status;
   } info[NUM];
+
+  // request headers, also indexed by first descriptor;
+  // in the kernel's direct-mapped data, so the device
+  // can be given their addresses as they are.
+  struct virtio_blk_outhdr {
+    uint32 type;
+    uint32 reserved;
+    uint64 sector;
+  } ops[NUM];
   
   struct spinlock vdisk_lock;
   
-} __attribute__ ((aligned (PGSIZE))) disk;
+} disk;
 
 void
 virtio_disk_init(void)
@@ -95,7 +103,9 @@ virtio_disk_init(void)
   if(max < NUM)
     panic("virtio disk max queue too short");
   *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
-  memset(disk.pages, 0, sizeof(disk.pages));
+  if((disk.pages = kalloc_pages(1)) == 0)
+    panic("virtio disk kalloc");
+  memset(disk.pages, 0, 2*PGSIZE);
   *R(VIRTIO_MMIO_QUEUE_PFN) = ((uint64)disk.pages) >> PGSHIFT;
 
   // desc = pages -- num * VRingDesc
@@ -112,17 +122,22 @@ virtio_disk_init(void)
   // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
 }
 
-// find a free descriptor, mark it non-free, return its index.
+// find n free descriptors, mark them non-free,
+// and return their indices in idx.
+// returns -1, allocating none, if there aren't n free.
 static int
-alloc_desc()
+alloc_descs(int *idx, int n)
 {
-  for(int i = 0; i < NUM; i++){
-    if(disk.free[i]){
-      disk.free[i] = 0;
-      return i;
-    }
-  }
-  return -1;
+  int i, j;
+
+  for(i = 0, j = 0; i < NUM && j < n; i++)
+    if(disk.free[i])
+      idx[j++] = i;
+  if(j < n)
+    return -1;
+  for(j = 0; j < n; j++)
+    disk.free[idx[j]] = 0;
+  return 0;
 }
 
 // mark a descriptor as free.
@@ -135,7 +150,6 @@ free_desc(int i)
     panic("virtio_disk_intr 2");
   disk.desc[i].addr = 0;
   disk.free[i] = 1;
-  wakeup(&disk.free[0]);
 }
 
 // free a chain of descriptors.
@@ -151,81 +165,53 @@ free_chain(int i)
   }
 }
 
-static int
-alloc3_desc(int *idx)
-{
-  for(int i = 0; i < 3; i++){
-    idx[i] = alloc_desc();
-    if(idx[i] < 0){
-      for(int j = 0; j < i; j++)
-        free_desc(idx[j]);
-      return -1;
-    }
-  }
-  return 0;
-}
-
-void
-virtio_disk_rw(struct buf *b, int write)
+// Put one request for the n consecutive blocks starting
+// with b (linked through qnext) on the avail ring.
+// idx holds n+2 descriptors.
+static void
+start_req(struct buf *b, int n, int *idx, int write)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
-
-  // the spec says that legacy block operations use three
-  // descriptors: one for type/reserved/sector, one for
-  // the data, one for a 1-byte status result.
+  struct virtio_blk_outhdr *hdr = &disk.ops[idx[0]];
+  int i;
 
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
-  }
-  
-  // format the three descriptors.
+  // the spec says that legacy block operations use a
+  // descriptor for type/reserved/sector, descriptors for
+  // the data, and one for a 1-byte status result.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_outhdr {
-    uint32 type;
-    uint32 reserved;
-    uint64 sector;
-  } buf0;
-
   if(write)
-    buf0.type = VIRTIO_BLK_T_OUT; // write the disk
+    hdr->type = VIRTIO_BLK_T_OUT; // write the disk
   else
-    buf0.type = VIRTIO_BLK_T_IN; // read the disk
-  buf0.reserved = 0;
-  buf0.sector = sector;
-
-  // buf0 is on a kernel stack, which is not direct mapped,
-  // thus the call to kvmpa().
-  disk.desc[idx[0]].addr = (uint64) kvmpa((uint64) &buf0);
-  disk.desc[idx[0]].len = sizeof(buf0);
+    hdr->type = VIRTIO_BLK_T_IN; // read the disk
+  hdr->reserved = 0;
+  hdr->sector = b->blockno * (BSIZE / 512);
+
+  disk.desc[idx[0]].addr = (uint64) hdr;
+  disk.desc[idx[0]].len = sizeof(*hdr);
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
-
-  disk.info[idx[0]].status = 0;
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
-
   // record struct buf for virtio_disk_intr().
-  b->disk = 1;
   disk.info[idx[0]].b = b;
+  disk.info[idx[0]].n = n;
+
+  for(i = 1; i <= n; i++, b = b->qnext){
+    disk.desc[idx[i]].addr = (uint64) b->data;
+    disk.desc[idx[i]].len = BSIZE;
+    if(write)
+      disk.desc[idx[i]].flags = 0; // device reads b->data
+    else
+      disk.desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes b->data
+    disk.desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+    disk.desc[idx[i]].next = idx[i+1];
+    b->disk = 1;
+  }
+
+  disk.info[idx[0]].status = 0;
+  disk.desc[idx[n+1]].addr = (uint64) &disk.info[idx[0]].status;
+  disk.desc[idx[n+1]].len = 1;
+  disk.desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk.desc[idx[n+1]].next = 0;
 
   // avail[0] is flags
   // avail[1] tells the device how far to look in avail[2...].
@@ -234,23 +220,71 @@ virtio_disk_rw(struct buf *b, int write)
   disk.avail[2 + (disk.avail[1] % NUM)] = idx[0];
   __sync_synchronize();
   disk.avail[1] = disk.avail[1] + 1;
+}
+
+// Start I/O on a list of locked bufs, linked through qnext,
+// without waiting for it to finish: reads if write is 0,
+// else writes. Each run of up to MAXSEG consecutive blocks
+// goes to the device as one request, and requests are queued
+// for as long as descriptors last, so the device has plenty
+// to work on. Sleeps only if the ring is full.
+// When a buf's I/O is done, the interrupt handler clears
+// b->disk and calls b->iodone(b) if it is set, otherwise it
+// wakes up virtio_disk_wait(). qnext must be left alone
+// until then.
+void
+virtio_disk_submit(struct buf *list, int write)
+{
+  struct buf *b, *last;
+  int n, idx[MAXSEG+2];
 
+  acquire(&disk.vdisk_lock);
+  for(b = list; b; b = last->qnext){
+    n = 1;
+    last = b;
+    while(n < MAXSEG && last->qnext && last->qnext->dev == b->dev &&
+          last->qnext->blockno == last->blockno + 1){
+      last = last->qnext;
+      n++;
+    }
+    while(alloc_descs(idx, n+2) < 0){
+      // let the device at what is queued, and wait
+      // for it to finish something.
+      *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0;
+      sleep(&disk.free[0], &disk.vdisk_lock);
+    }
+    start_req(b, n, idx, write);
+  }
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  release(&disk.vdisk_lock);
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
+// Wait for virtio_disk_intr() to say b's I/O has finished.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
-
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
-
   release(&disk.vdisk_lock);
 }
 
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  b->qnext = 0;
+  b->iodone = 0;
+  virtio_disk_submit(b, write);
+  virtio_disk_wait(b);
+}
+
 void
 virtio_disk_intr()
 {
+  struct buf *b, *next;
+  int i;
+
   acquire(&disk.vdisk_lock);
 
   while((disk.used_idx % NUM) != (disk.used->id % NUM)){
@@ -258,12 +292,22 @@ virtio_disk_intr()
 
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
-    
-    disk.info[id].b->disk = 0;   // disk is done with buf
-    wakeup(disk.info[id].b);
+
+    b = disk.info[id].b;
+    for(i = 0; i < disk.info[id].n; i++, b = next){
+      next = b->qnext;
+      b->disk = 0;   // disk is done with buf
+      if(b->iodone)
+        b->iodone(b);
+      else
+        wakeup(b);
+    }
+    disk.info[id].b = 0;
+    free_chain(id);
 
     disk.used_idx = (disk.used_idx + 1) % NUM;
   }
+  wakeup(&disk.free[0]);
 
   release(&disk.vdisk_lock);
 }
@@ -5,6 +5,8 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "proc.h"
 
 /*
  * the kernel's page table.
@@ -15,6 +17,8 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+static pte_t *walk(pagetable_t pagetable, uint64 va, int alloc);
+
 /*
  * create a direct-map page table for the kernel and
  * turn on paging. called early, in supervisor mode.
@@ -47,6 +51,13 @@ kvminit()
 	// map the trampoline for trap entry/exit to
 	// the highest virtual address in the kernel.
 	kvmmap(TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
+
+	// make the page-table pages for the kernel stacks now;
+	// procgrow() maps stacks there later, and can't be
+	// left short of memory half way through a mapping.
+	for(uint64 va = KSTACK(NPROC-1); va < TRAMPOLINE; va += PGSIZE)
+		if(walk(kernel_pagetable, va, 1) == 0)
+			panic("kvminit");
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -114,7 +125,7 @@ walkaddr(pagetable_t pagetable, uint64 va)
 }
 
 // add a mapping to the kernel page table.
-// only used when booting.
+// used when booting, and by procgrow() for kernel stacks.
 // does not flush TLB or enable paging.
 void
 kvmmap(uint64 va, uint64 pa, uint64 sz, int perm)
@@ -169,8 +180,9 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 	return 0;
 }
 
-// Remove mappings from a page table. The mappings in
-// the given range must exist. Optionally free the
+// Remove mappings from a page table. Pages in the given
+// range that aren't mapped, such as lazily allocated heap
+// never touched, are skipped. Optionally free the
 // physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 size, int do_free)
@@ -181,13 +193,11 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 size, int do_free)
 
 	a = PGROUNDDOWN(va);
 	last = PGROUNDDOWN(va + size - 1);
-	for(;;) {
-		if((pte = walk(pagetable, a, 0)) == 0)
-			panic("uvmunmap: walk");
-		if((*pte & PTE_V) == 0) {
-			printf("va=%p pte=%p\n", a, *pte);
-			panic("uvmunmap: not mapped");
-		}
+	for(; a <= last; a += PGSIZE) {
+		// heap that sbrk() reserved but that was never
+		// touched isn't mapped; see uvmlazy().
+		if((pte = walk(pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+			continue;
 		if(PTE_FLAGS(*pte) == PTE_V)
 			panic("uvmunmap: not a leaf");
 		if(do_free) {
@@ -195,10 +205,6 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 size, int do_free)
 			kfree((void*)pa);
 		}
 		*pte = 0;
-		if(a == last)
-			break;
-		a += PGSIZE;
-		pa += PGSIZE;
 	}
 }
 
@@ -307,8 +313,9 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Copies the page table, but shares the physical
+// memory: writable pages become read-only and
+// copy-on-write in both, see uvmcow().
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
@@ -317,23 +324,21 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 	pte_t *pte;
 	uint64 pa, i;
 	uint flags;
-	char *mem;
 
 	for(i = 0; i < sz; i += PGSIZE) {
-		if((pte = walk(old, i, 0)) == 0)
-			panic("uvmcopy: pte should exist");
-		if((*pte & PTE_V) == 0)
-			panic("uvmcopy: page not present");
+		// untouched heap stays untouched in the child.
+		if((pte = walk(old, i, 0)) == 0 || (*pte & PTE_V) == 0)
+			continue;
+		if(*pte & PTE_W)
+			*pte = (*pte & ~PTE_W) | PTE_COW;
 		pa = PTE2PA(*pte);
 		flags = PTE_FLAGS(*pte);
-		if((mem = kalloc()) == 0)
-			goto err;
-		memmove(mem, (char*)pa, PGSIZE);
-		if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0) {
-			kfree(mem);
+		if(mappages(new, i, PGSIZE, pa, flags) != 0)
 			goto err;
-		}
+		kref((void*)pa);
 	}
+	// no need to flush the old page table's stale writable
+	// entries here: userret flushes the TLB on the way out.
 	return 0;
 
 err:
@@ -354,6 +359,141 @@ uvmclear(pagetable_t pagetable, uint64 va)
 	*pte &= ~PTE_U;
 }
 
+// Give the page at va a private, writable copy of its
+// copy-on-write memory, on a store fault or before the
+// kernel writes to it. The copy is charged to the
+// current process's container.
+// returns 0 on success, -1 if va isn't a copy-on-write
+// user page, -2 if memory is short.
+int
+uvmcow(pagetable_t pagetable, uint64 va)
+{
+	pte_t *pte;
+	uint64 pa;
+	uint flags;
+	char *mem;
+
+	if(va >= MAXVA)
+		return -1;
+	va = PGROUNDDOWN(va);
+	if((pte = walk(pagetable, va, 0)) == 0)
+		return -1;
+	if((*pte & (PTE_V | PTE_U | PTE_COW)) != (PTE_V | PTE_U | PTE_COW))
+		return -1;
+	pa = PTE2PA(*pte);
+	flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+
+	// the last sharer can just take the page back.
+	if(krefcnt((void*)pa) == 1) {
+		*pte = PA2PTE(pa) | flags;
+		return 0;
+	}
+
+	if((mem = kalloc()) == 0)
+		return -2;
+	memmove(mem, (char*)pa, PGSIZE);
+	*pte = PA2PTE(mem) | flags;
+	kfree((void*)pa);
+	return 0;
+}
+
+// Give va a zeroed page on first touch, if it is in [0, sz)
+// but not mapped: sbrk() only reserves address space. The
+// page is charged to the current process's container.
+// returns 0 on success, -1 if va isn't such an address,
+// -2 if memory is short.
+int
+uvmlazy(pagetable_t pagetable, uint64 va, uint64 sz)
+{
+	pte_t *pte;
+	char *mem;
+
+	if(va >= sz || va >= MAXVA)
+		return -1;
+	va = PGROUNDDOWN(va);
+	if((pte = walk(pagetable, va, 0)) != 0 && (*pte & PTE_V) != 0)
+		return -1;
+	if((mem = kalloc()) == 0)
+		return -2;
+	memset(mem, 0, PGSIZE);
+	if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0) {
+		kfree(mem);
+		return -2;
+	}
+	return 0;
+}
+
+// Fault in the page at va for copyin() or copyout(),
+// if pagetable is the current process's.
+// returns the physical address of va's page, or 0.
+static uint64
+copyfault(pagetable_t pagetable, uint64 va)
+{
+	struct proc *p = myproc();
+
+	if(p->pagetable != pagetable || uvmlazy(pagetable, va, p->sz) < 0)
+		return 0;
+	return walkaddr(pagetable, va);
+}
+
+// Find the leaf PTE for user page va, like walk(), but
+// using the current process's software TLB if pagetable is
+// its own, so that copying a few bytes at a time to or from
+// the same page walks the page table only once. An entry
+// points into the page table, and callers check the PTE's
+// flags on each use, so unmapping or remapping the page
+// needs no flush; only freeing or replacing the page table
+// does (see utlbflush()).
+static pte_t *
+uwalk(pagetable_t pagetable, uint64 va)
+{
+	struct proc *p = myproc();
+	struct utlb *e;
+	pte_t *pte;
+	int hit;
+
+	if(va >= MAXVA)
+		return 0;
+	if(p->pagetable != pagetable)
+		return walk(pagetable, va, 0);
+	e = &p->utlb[(va >> PGSHIFT) % NUTLB];
+	hit = e->pte && e->va == va;
+	// count per CPU, to keep a shared line out of every copy.
+	push_off();
+	if(hit)
+		mycpu()->utlbhits++;
+	else
+		mycpu()->utlbmisses++;
+	pop_off();
+	if(hit)
+		return e->pte;
+	if((pte = walk(pagetable, va, 0)) != 0) {
+		e->va = va;
+		e->pte = pte;
+	}
+	return pte;
+}
+
+// walkaddr() through the software TLB.
+static uint64
+uwalkaddr(pagetable_t pagetable, uint64 va)
+{
+	pte_t *pte = uwalk(pagetable, va);
+
+	if(pte == 0 || (*pte & (PTE_V | PTE_U)) != (PTE_V | PTE_U))
+		return 0;
+	return PTE2PA(*pte);
+}
+
+// Forget p's software TLB entries. Must be called
+// whenever p->pagetable is set, since the old page
+// table may be freed and its pages reused.
+void
+utlbflush(struct proc *p)
+{
+	memset(p->utlb, 0, sizeof(p->utlb));
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
@@ -361,11 +501,17 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
 	uint64 n, va0, pa0;
+	pte_t *pte;
 
 	while(len > 0) {
 		va0 = PGROUNDDOWN(dstva);
-		pa0 = walkaddr(pagetable, va0);
-		if(pa0 == 0)
+		if(va0 >= MAXVA)
+			return -1;
+		pte = uwalk(pagetable, va0);
+		if(pte && (*pte & PTE_COW) && uvmcow(pagetable, va0) < 0)
+			return -1;
+		pa0 = uwalkaddr(pagetable, va0);
+		if(pa0 == 0 && (pa0 = copyfault(pagetable, va0)) == 0)
 			return -1;
 		n = PGSIZE - (dstva - va0);
 		if(n > len)
@@ -389,8 +535,8 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 
 	while(len > 0) {
 		va0 = PGROUNDDOWN(srcva);
-		pa0 = walkaddr(pagetable, va0);
-		if(pa0 == 0)
+		pa0 = uwalkaddr(pagetable, va0);
+		if(pa0 == 0 && (pa0 = copyfault(pagetable, va0)) == 0)
 			return -1;
 		n = PGSIZE - (srcva - va0);
 		if(n > len)
@@ -416,8 +562,8 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 
 	while(got_null == 0 && max > 0) {
 		va0 = PGROUNDDOWN(srcva);
-		pa0 = walkaddr(pagetable, va0);
-		if(pa0 == 0)
+		pa0 = uwalkaddr(pagetable, va0);
+		if(pa0 == 0 && (pa0 = copyfault(pagetable, va0)) == 0)
 			return -1;
 		n = PGSIZE - (srcva - va0);
 		if(n > max)
@@ -1,20 +1,24 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user/user.h"
+#include "kernel/param.h"
 
 int
 main (int argc, char *argv[]){
 	struct ctable *ctable;
+	struct ptable *ptable;
 	struct container_info *c;
 	struct proc_info *p;
-	int count;
+	int count, pcount, start;
 
 	ctable = (struct ctable*)malloc(sizeof(struct ctable));
+	ptable = (struct ptable*)malloc(sizeof(struct ptable));
 
 	int rv = cinfo(ctable, &count);
 	if (rv != 0) {
 		printf("cinfo failed: cannot execute outside of root\n");
 		free((void *)ctable);
+		free((void *)ptable);
 		exit(-1);
 	}
 
@@ -37,19 +41,39 @@ main (int argc, char *argv[]){
 		       c->diskused,
 		       c->disklimit
 		       );
+		printf("\tCPU:%d ticks\tSHARES:%d\tQUOTA:",
+		       c->cputicks,
+		       c->shares
+		       );
+		if (c->quota > 0) {
+			printf("%d/%d ticks\n", c->quota, CPERIOD);
+		} else {
+			printf("none\n");
+		}
 		printf("\tPID\tVPID\tMEM\tNAME\tCONT\tPARENT\n");
-		for (p = c->ptable.procs; p < &c->ptable.procs[c->numproc]; p++) {
-			printf("\t%d\t%d\t%dK\t%s\t%s\t%s\n",
-			       p->pid,
-			       p->vpid,
-			       p->mem / 1000,
-			       p->name,
-			       p->container,
-			       p->parent
-			       );
+		for (start = 0; start >= 0; ) {
+			pcount = 0;
+			start = psinfo(ptable, start, &pcount);
+			if (start < -1) {
+				printf("cinfo: psinfo failed\n");
+				break;
+			}
+			for (p = ptable->procs; p < &ptable->procs[pcount]; p++) {
+				if (strcmp(p->container, c->name) != 0)
+					continue;
+				printf("\t%d\t%d\t%dK\t%s\t%s\t%s\n",
+				       p->pid,
+				       p->vpid,
+				       p->mem / 1000,
+				       p->name,
+				       p->container,
+				       p->parent
+				       );
+			}
 		}
 		printf("\n");
 	}
 	free((void *)ctable);
+	free((void *)ptable);
 	exit(0);
 }
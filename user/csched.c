@@ -0,0 +1,20 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/param.h"
+
+int
+main(int argc, char *argv[])
+{
+	if (argc != 4) {
+		printf("usage: csched <name> <shares> <quota>\n");
+		printf("\tshares: cpu weight, default %d\n", CSHARES);
+		printf("\tquota: ticks per %d-tick period, 0 for no limit\n", CPERIOD);
+		exit(-1);
+	}
+	if (csched(argv[1], atoi(argv[2]), atoi(argv[3])) < 0) {
+		printf("csched: failed to set %s\n", argv[1]);
+		exit(-1);
+	}
+	exit(0);
+}
@@ -0,0 +1,33 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/kstat.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+	struct kstat st;
+	int k;
+
+	if (kstat(&st) < 0) {
+		printf("kstat: failed\n");
+		exit(-1);
+	}
+	printf("wakeups: %d (%d with no sleeper)\n", (int)st.wakeups, (int)st.wakeupempty);
+	printf("bcache: %d buffers, %d hits, %d misses, %d read ahead\n",
+	       (int)st.nbuf, (int)st.bhits, (int)st.bmisses, (int)st.bahead);
+	printf("log: %d commits, %d blocks\n",
+	       (int)st.commits, (int)st.logblocks);
+	printf("dcache: %d hits, %d misses\n",
+	       (int)st.dhits, (int)st.dmisses);
+	printf("icache: %d inodes, %d hits, %d misses\n",
+	       (int)st.ninode, (int)st.ihits, (int)st.imisses);
+	printf("utlb: %d hits, %d misses\n",
+	       (int)st.utlbhits, (int)st.utlbmisses);
+	printf("trace: %d events dropped\n", (int)st.tracedrops);
+	printf("order\tfree\tallocs\n");
+	for (k = 0; k <= MAXORDER; k++)
+		printf("%d\t%d\t%d\n", k, (int)st.buddyfree[k], (int)st.buddyallocs[k]);
+	exit(0);
+}
@@ -0,0 +1,77 @@
+/* pipebench.c - time moving data through pipes of several sizes. */
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define KB 1024
+#define MB (KB * KB)
+#define CHUNK (16 * KB)
+
+char buf[CHUNK];
+
+// Send mb MB through a pipe with an npages-page buffer
+// (0 for a plain pipe()) in writes of chunk bytes, and
+// print how long it took.
+void
+bench(int npages, int mb, int chunk)
+{
+	int fds[2], n, pid, t0, t;
+	uint total;
+
+	if ((npages ? pipe2(fds, npages) : pipe(fds)) < 0) {
+		printf("pipebench: pipe failed\n");
+		exit(-1);
+	}
+	t0 = uptime();
+	pid = fork();
+	if (pid < 0) {
+		printf("pipebench: fork failed\n");
+		exit(-1);
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		for (total = 0; total < mb * MB; total += chunk) {
+			if (write(fds[1], buf, chunk) != chunk) {
+				printf("pipebench: write failed\n");
+				exit(-1);
+			}
+		}
+		exit(0);
+	}
+	close(fds[1]);
+	total = 0;
+	while ((n = read(fds[0], buf, sizeof(buf))) > 0)
+		total += n;
+	close(fds[0]);
+	wait(0);
+	t = uptime() - t0;
+	if (total != mb * MB) {
+		printf("pipebench: read %d bytes, expected %d\n", total, mb * MB);
+		exit(-1);
+	}
+	if (npages)
+		printf("pipe2 %d pages", npages);
+	else
+		printf("pipe");
+	printf("\t%d bytes/write\t%d MB in %d ticks\n", chunk, mb, t);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int mb = 8, npages;
+
+	if (argc > 1)
+		mb = atoi(argv[1]);
+	if (mb <= 0) {
+		printf("usage: pipebench [MB]\n");
+		exit(-1);
+	}
+	memset(buf, 'p', sizeof(buf));
+	bench(0, mb, 512);
+	bench(0, mb, CHUNK);
+	for (npages = 1; npages <= 16; npages *= 4)
+		bench(npages, mb, CHUNK);
+	exit(0);
+}
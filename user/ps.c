@@ -6,22 +6,28 @@ int
 main (int argc, char *argv[]){
 	struct ptable *ptable;
 	struct proc_info *p;
-	int count;
+	int count, start;
 
 	ptable = (struct ptable*)malloc(sizeof(struct ptable));
 
-	psinfo(ptable, &count);
-
 	printf("\tPID\tVPID\tMEM\tNAME\tCONT\tPARENT\n");
-	for (p = ptable->procs; p < &ptable->procs[count]; p++) {
-		printf("\t%d\t%d\t%dK\t%s\t%s\t%s\n",
-		       p->pid,
-		       p->vpid,
-		       p->mem / 1000,
-		       p->name,
-		       p->container,
-		       p->parent
-		       );
+	for (start = 0; start >= 0; ) {
+		count = 0;
+		start = psinfo(ptable, start, &count);
+		if (start < -1) {
+			printf("ps: psinfo failed\n");
+			break;
+		}
+		for (p = ptable->procs; p < &ptable->procs[count]; p++) {
+			printf("\t%d\t%d\t%dK\t%s\t%s\t%s\n",
+			       p->pid,
+			       p->vpid,
+			       p->mem / 1000,
+			       p->name,
+			       p->container,
+			       p->parent
+			       );
+		}
 	}
 	exit(0);
 }
@@ -1,22 +1,151 @@
-#include "types.h"
-#include "stat.h"
-#include "user.h"
+/* strace.c - run a program, printing the system calls it makes. */
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/kstat.h"
+#include "kernel/syscall.h"
+#include "kernel/trace.h"
+#include "user/user.h"
+
+#define NELEM(x) (sizeof(x)/sizeof((x)[0]))
+#define NEV 32
+
+struct traceevent ev[NEV];
+
+// Print n bytes of s, escaping what isn't printable.
+void
+putstr(char *s, int n)
+{
+	int i;
+
+	for (i = 0; i < n && s[i]; i++) {
+		if (s[i] == '\n')
+			printf("\\n");
+		else if (s[i] == '\t')
+			printf("\\t");
+		else if (s[i] < ' ' || s[i] > '~')
+			printf(".");
+		else
+			printf("%c", s[i]);
+	}
+}
+
+// Print one event as
+//   [pid] name(args) = ret <microseconds>
+void
+print(struct traceevent *e)
+{
+	char *name = 0, *args = "";
+	int i, len, str = 0;
+
+	if (e->num > 0 && e->num < NELEM(sysdescs)) {
+		name = sysdescs[e->num].name;
+		args = sysdescs[e->num].args;
+	}
+	if (name == 0) {
+		printf("[%d] syscall %d() = %d\n", e->pid, e->num, (int)e->ret);
+		return;
+	}
+	printf("[%d] %s(", e->pid, name);
+	for (i = 0; args[i]; i++) {
+		if (i > 0)
+			printf(", ");
+		if (args[i] == 'd') {
+			printf("%d", (int)e->arg[i]);
+		} else if (args[i] == 's' && !str) {
+			str = 1;
+			printf("\"");
+			putstr(e->str, TRACESTR);
+			printf("\"");
+		} else if (args[i] == 'b' && !str) {
+			str = 1;
+			len = e->arg[i+1] < TRACESTR ? e->arg[i+1] : TRACESTR;
+			printf("\"");
+			putstr(e->str, len);
+			printf(len < e->arg[i+1] ? "\"..." : "\"");
+		} else {
+			printf("%p", e->arg[i]);
+		}
+	}
+	if (e->num == SYS_exit)
+		printf(")\n");
+	else
+		printf(") = %d <%dus>\n", (int)e->ret,
+		       (int)(e->time * 1000000 / TIMERHZ));
+}
+
+// Put ev[0..n-1] in order of when the calls were made,
+// since each CPU's events come separately.
+void
+sort(int n)
+{
+	struct traceevent t;
+	int i, j;
+
+	for (i = 1; i < n; i++) {
+		t = ev[i];
+		for (j = i; j > 0 && ev[j-1].start > t.start; j--)
+			ev[j] = ev[j-1];
+		ev[j] = t;
+	}
+}
 
 int
 main(int argc, char *argv[])
 {
-	int id;
-	char *progname = argv[1];
+	struct kstat st;
+	int pid, n, i, fds[2], drops, execed = 0, done = 0;
+	char c;
 
-	id = fork();
-	if (id == 0) {
-		/* we are in the child */
+	if (argc < 2) {
+		printf("usage: strace program [args...]\n");
+		exit(-1);
+	}
+	if (pipe(fds) < 0 || kstat(&st) < 0) {
+		printf("strace: setup failed\n");
+		exit(-1);
+	}
+	drops = st.tracedrops;
+	pid = fork();
+	if (pid < 0) {
+		printf("strace: fork failed\n");
+		exit(-1);
+	}
+	if (pid == 0) {
+		/* we are in the child: tell the parent once traced */
+		close(fds[0]);
 		traceon();
-		exec(progname, &argv[1]);
-		exit(0);
-	} else {
-		/* we are in the parent */
-		id = wait(&id);
+		close(fds[1]);
+		exec(argv[1], &argv[1]);
+		printf("strace: exec %s failed\n", argv[1]);
+		exit(-1);
+	}
+
+	/* we are in the parent: wait until the child is traced */
+	close(fds[1]);
+	read(fds[0], &c, 1);
+	close(fds[0]);
+
+	/* print the child's events, from its exec, until it exits */
+	while (!done) {
+		n = trace(ev, NEV);
+		if (n < 0)
+			break;  // nothing is traced any more
+		sort(n);
+		for (i = 0; i < n; i++) {
+			if (ev[i].pid != pid)
+				continue;  // another strace's
+			if (ev[i].num == SYS_exec)
+				execed = 1;
+			if (execed)
+				print(&ev[i]);
+			if (ev[i].num == SYS_exit)
+				done = 1;
+		}
 	}
+	wait(0);
+	if (kstat(&st) == 0 && st.tracedrops != drops)
+		printf("strace: %d events dropped\n", (int)st.tracedrops - drops);
 	exit(0);
 }
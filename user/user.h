@@ -1,5 +1,7 @@
 struct stat;
 struct rtcdate;
+struct kstat;
+struct traceevent;
 
 struct proc_info {
 	int pid;
@@ -10,8 +12,9 @@ struct proc_info {
 	char container[16];
 };
 
+// One page of psinfo() results (NPINFO).
 struct ptable {
-	struct proc_info procs[64];
+	struct proc_info procs[32];
 };
 
 struct container_info {
@@ -24,8 +27,10 @@ struct container_info {
 	int memlimit;
 	int diskused;
 	int disklimit;
+	int shares;
+	int quota;
+	int cputicks;
 	char root[128];
-	struct ptable ptable;
 };
 
 struct ctable {
@@ -55,7 +60,7 @@ char* sbrk(int);
 int sleep(int);
 int uptime(void);
 int traceon(void);
-int psinfo(struct ptable*, int*);
+int psinfo(struct ptable*, int, int*);
 int suspend(int, int);
 int resume(char *);
 int cinfo(struct ctable*, int*);
@@ -63,6 +68,10 @@ int cinit(char *, char *, int, int, int);
 int cpause(char *);
 int cresume(char *);
 int cstop(char *);
+int csched(char *, int, int);
+int kstat(struct kstat*);
+int pipe2(int*, int);
+int trace(struct traceevent*, int);
 
 
 
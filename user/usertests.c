@@ -389,6 +389,71 @@ pipe1(char *s)
   }
 }
 
+// does pipe2() reject bad sizes, and do single writes of more
+// than a page, and of more than the whole buffer, arrive intact
+// through multi-page pipes?
+void
+pipe2test(char *s)
+{
+  enum { SZ=5*PGSIZE+123 };
+  int sizes[] = { 1, 3, PIPEMAXPAGES };
+  int fds[2], pid, xstatus, i, k, n, total;
+  char *a, *b;
+
+  if(pipe2(fds, 0) == 0 || pipe2(fds, -1) == 0 || pipe2(fds, PIPEMAXPAGES+1) == 0){
+    printf("%s: pipe2() accepted a bad size\n", s);
+    exit(1);
+  }
+
+  a = sbrk(2*SZ);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  b = a + SZ;
+  for(i = 0; i < SZ; i++)
+    a[i] = i % 251;
+
+  for(k = 0; k < sizeof(sizes)/sizeof(sizes[0]); k++){
+    if(pipe2(fds, sizes[k]) != 0){
+      printf("%s: pipe2(%d) failed\n", s, sizes[k]);
+      exit(1);
+    }
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[0]);
+      if(write(fds[1], a, SZ) != SZ){
+        printf("%s: pipe2(%d) short write\n", s, sizes[k]);
+        exit(1);
+      }
+      exit(0);
+    }
+    close(fds[1]);
+    memset(b, 0, SZ);
+    total = 0;
+    while((n = read(fds[0], b + total, SZ - total)) > 0)
+      total += n;
+    close(fds[0]);
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+    if(total != SZ){
+      printf("%s: pipe2(%d) read %d of %d\n", s, sizes[k], total, SZ);
+      exit(1);
+    }
+    for(i = 0; i < SZ; i++){
+      if(b[i] != a[i]){
+        printf("%s: pipe2(%d) wrong data at %d\n", s, sizes[k], i);
+        exit(1);
+      }
+    }
+  }
+}
+
 // meant to be run w/ at most two CPUs
 void
 preempt(char *s)
@@ -1124,6 +1189,101 @@ bigdir(char *s)
   }
 }
 
+// grow a directory well past one block, so that it is converted
+// to hashed form, then check lookup, unlink, and re-create, and
+// that reading it as dirents still lists just its entries.
+void
+hashdir(char *s)
+{
+  enum { N=300 };
+  struct dirent de;
+  int fd, i, n;
+  char name[5];
+
+  name[0] = 'h';
+  name[4] = '\0';
+  if(mkdir("hd") != 0 || chdir("hd") != 0){
+    printf("%s: mkdir hd failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    name[1] = '0' + i / 100;
+    name[2] = '0' + (i / 10) % 10;
+    name[3] = '0' + i % 10;
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+      printf("%s: create %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+  // unlink every other entry.
+  for(i = 0; i < N; i += 2){
+    name[1] = '0' + i / 100;
+    name[2] = '0' + (i / 10) % 10;
+    name[3] = '0' + i % 10;
+    if(unlink(name) != 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    name[1] = '0' + i / 100;
+    name[2] = '0' + (i / 10) % 10;
+    name[3] = '0' + i % 10;
+    fd = open(name, O_RDWR);
+    if((fd >= 0) != (i % 2 == 1)){
+      printf("%s: %s %s after unlink\n", s, name, fd >= 0 ? "found" : "lost");
+      exit(1);
+    }
+    close(fd);
+  }
+  // re-create what was unlinked.
+  for(i = 0; i < N; i += 2){
+    name[1] = '0' + i / 100;
+    name[2] = '0' + (i / 10) % 10;
+    name[3] = '0' + i % 10;
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+      printf("%s: re-create %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+
+  if((fd = open(".", 0)) < 0){
+    printf("%s: open hd failed\n", s);
+    exit(1);
+  }
+  n = 0;
+  while(read(fd, &de, sizeof(de)) == sizeof(de)){
+    if(de.inum == 0 || strcmp(de.name, ".") == 0 || strcmp(de.name, "..") == 0)
+      continue;
+    if(de.name[0] != 'h'){
+      printf("%s: stray dirent %s\n", s, de.name);
+      exit(1);
+    }
+    n++;
+  }
+  close(fd);
+  if(n != N){
+    printf("%s: %d dirents, not %d\n", s, n, N);
+    exit(1);
+  }
+
+  for(i = 0; i < N; i++){
+    name[1] = '0' + i / 100;
+    name[2] = '0' + (i / 10) % 10;
+    name[3] = '0' + i % 10;
+    if(unlink(name) != 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(chdir("..") != 0 || unlink("hd") != 0){
+    printf("%s: unlink hd failed\n", s);
+    exit(1);
+  }
+}
+
 void
 subdir(char *s)
 {
@@ -1382,6 +1542,58 @@ bigfile(char *s)
   unlink("bigfile");
 }
 
+// a file bigger than the direct and single-indirect blocks can
+// map, so that it needs the double-indirect block.
+void
+hugefile(char *s)
+{
+  enum { N=NDIRECT+NINDIRECT+20 };
+  int fd, i;
+  uint *w = (uint*)buf;
+
+  unlink("hugefile");
+  fd = open("hugefile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create hugefile\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    memset(buf, i, BSIZE);
+    w[0] = i;
+    w[BSIZE/sizeof(uint)-1] = i;
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: write hugefile block %d failed\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  fd = open("hugefile", 0);
+  if(fd < 0){
+    printf("%s: cannot open hugefile\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if(read(fd, buf, BSIZE) != BSIZE){
+      printf("%s: read hugefile block %d failed\n", s, i);
+      exit(1);
+    }
+    if(w[0] != i || w[BSIZE/sizeof(uint)-1] != i || buf[BSIZE/2] != (char)i){
+      printf("%s: hugefile block %d wrong data\n", s, i);
+      exit(1);
+    }
+  }
+  if(read(fd, buf, 1) != 0){
+    printf("%s: hugefile too long\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(unlink("hugefile") != 0){
+    printf("%s: unlink hugefile failed\n", s);
+    exit(1);
+  }
+}
+
 void
 fourteen(char *s)
 {
@@ -1582,6 +1794,117 @@ forktest(char *s)
   }
 }
 
+// after fork(), parent and child share their pages copy-on-write.
+// does a store by either one stay private to it?
+void
+cowfork(char *s)
+{
+  enum { N=3*PGSIZE };
+  int fds[2], pid, xstatus, i;
+  char *a, c;
+
+  a = sbrk(N);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  memset(a, 'a', N);
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // wait for the parent's store, then make our own.
+    close(fds[1]);
+    if(read(fds[0], &c, 1) != 1)
+      exit(1);
+    for(i = 0; i < N; i++){
+      if(a[i] != 'a'){
+        printf("%s: child sees parent's store at %d\n", s, i);
+        exit(1);
+      }
+    }
+    memset(a, 'c', N);
+    for(i = 0; i < N; i++){
+      if(a[i] != 'c'){
+        printf("%s: child lost its own store at %d\n", s, i);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  close(fds[0]);
+  memset(a, 'p', N);
+  write(fds[1], "x", 1);
+  close(fds[1]);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  for(i = 0; i < N; i++){
+    if(a[i] != 'p'){
+      printf("%s: parent sees child's store at %d\n", s, i);
+      exit(1);
+    }
+  }
+}
+
+// does read() into a copy-on-write page copy it, rather than
+// writing through to the page the parent still has?
+void
+cowread(char *s)
+{
+  enum { SZ=2*PGSIZE };
+  int fd, pid, xstatus, i;
+
+  unlink("cowread");
+  fd = open("cowread", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create cowread\n", s);
+    exit(1);
+  }
+  memset(buf, 'f', SZ);
+  if(write(fd, buf, SZ) != SZ){
+    printf("%s: write cowread failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  memset(buf, 'p', SZ);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if((fd = open("cowread", 0)) < 0 || read(fd, buf, SZ) != SZ){
+      printf("%s: read cowread failed\n", s);
+      exit(1);
+    }
+    for(i = 0; i < SZ; i++){
+      if(buf[i] != 'f'){
+        printf("%s: child read wrong data at %d\n", s, i);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  unlink("cowread");
+  if(xstatus != 0)
+    exit(xstatus);
+  for(i = 0; i < SZ; i++){
+    if(buf[i] != 'p'){
+      printf("%s: child's read() reached parent at %d\n", s, i);
+      exit(1);
+    }
+  }
+}
+
 void
 sbrkbasic(char *s)
 {
@@ -1678,6 +2001,187 @@ sbrkmuch(char *s)
   }
 }
 
+// sbrk() only reserves address space; pages appear on first
+// touch. do untouched, touched, and read() pages all come out
+// zero, survive a shrink and regrow, and does a touch just past
+// the break still fault?
+void
+sbrklazy(char *s)
+{
+  enum { N=64 };
+  char *a, *b;
+  int fd, i, pid, xstatus;
+
+  // start on a page boundary, so that the break ends on one.
+  a = sbrk(0);
+  sbrk(PGROUNDUP((uint64)a) - (uint64)a);
+  a = sbrk(N*PGSIZE);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  // touch every other page, leaving the rest unmapped.
+  for(i = 0; i < N; i += 2){
+    if(a[i*PGSIZE] != 0){
+      printf("%s: page %d not zero\n", s, i);
+      exit(1);
+    }
+    a[i*PGSIZE] = 'x';
+  }
+  // copyout() to a page that was never touched.
+  if((fd = open("README", 0)) < 0 || read(fd, a + PGSIZE + 10, 1) != 1){
+    printf("%s: read into lazy page failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    a[N*PGSIZE] = 'x';  // past the break
+    printf("%s: store past the break succeeded\n", s);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: store past the break not killed\n", s);
+    exit(1);
+  }
+
+  // give back the touched and untouched pages alike, then
+  // grow again: the old contents must be gone.
+  if(sbrk(-N*PGSIZE) != a + N*PGSIZE || sbrk(0) != a){
+    printf("%s: sbrk shrink failed\n", s);
+    exit(1);
+  }
+  b = sbrk(N*PGSIZE);
+  if(b != a){
+    printf("%s: sbrk regrow at %p, not %p\n", s, b, a);
+    exit(1);
+  }
+  for(i = 0; i < N*PGSIZE; i += 512){
+    if(b[i] != 0){
+      printf("%s: regrown memory not zero at %d\n", s, i);
+      exit(1);
+    }
+  }
+}
+
+// does a lazy fault that would take a container over its
+// memlimit kill the process with XOOM?
+void
+sbrkxoom(char *s)
+{
+  enum { LIMIT=16, N=256 };
+  char *a;
+  int i, pid, xstatus;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(cinit("xoomtest", "/", 4, LIMIT, 100) < 0){
+      printf("%s: cinit failed\n", s);
+      exit(1);
+    }
+    // the reservation is within the limit until touched.
+    a = sbrk(N*PGSIZE);
+    if(a == (char*)0xffffffffffffffffL){
+      printf("%s: sbrk failed\n", s);
+      exit(1);
+    }
+    for(i = 0; i < N; i++)
+      a[i*PGSIZE] = 1;
+    printf("%s: touched %d pages over a limit of %d\n", s, N, LIMIT);
+    exit(1);
+  }
+  wait(&xstatus);
+  cstop("xoomtest");
+  if(xstatus != XOOM){
+    printf("%s: exit status %d, not XOOM\n", s, xstatus);
+    exit(1);
+  }
+}
+
+// the disk blocks charged to the named container, or -1.
+int
+diskused(char *name)
+{
+  struct ctable *ct;
+  int i, n, used = -1;
+
+  ct = malloc(sizeof(*ct));
+  if(cinfo(ct, &n) == 0){
+    for(i = 0; i < n; i++)
+      if(strcmp(ct->containers[i].name, name) == 0)
+        used = ct->containers[i].diskused;
+  }
+  free(ct);
+  return used;
+}
+
+// a container writes a file and is stopped; a new container
+// then gets the same slot and appends to the file. the blocks
+// must not be charged to the new container, which doesn't own
+// the file.
+void
+diskreuse(char *s)
+{
+  int fd, pid, xstatus, i;
+
+  unlink("/diskreuse");
+  for(i = 0; i < 2; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      if(cinit(i == 0 ? "dq1" : "dq2", "/", 4, 100, 100) < 0){
+        printf("%s: cinit failed\n", s);
+        exit(1);
+      }
+      fd = open("/diskreuse", O_CREATE|O_WRONLY);
+      if(fd < 0){
+        printf("%s: open diskreuse failed\n", s);
+        exit(1);
+      }
+      // append, for the second container.
+      while(read(fd, buf, BSIZE) > 0)
+        ;
+      memset(buf, 'd', 4*BSIZE);
+      if(write(fd, buf, 4*BSIZE) != 4*BSIZE){
+        printf("%s: write diskreuse failed\n", s);
+        exit(1);
+      }
+      close(fd);
+      exit(0);
+    }
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+    if(i == 0){
+      if(diskused("dq1") <= 0){
+        printf("%s: dq1 not charged for its file\n", s);
+        exit(1);
+      }
+      cstop("dq1");
+    }
+  }
+  xstatus = diskused("dq2");
+  cstop("dq2");
+  unlink("/diskreuse");
+  if(xstatus != 0){
+    printf("%s: dq2 charged %d blocks of dq1's file\n", s, xstatus);
+    exit(1);
+  }
+}
+
 // can we read the kernel's memory?
 void
 kernmem(char *s)
@@ -2148,6 +2652,9 @@ main(int argc, char *argv[])
     {bsstest, "bsstest"},
     {sbrkbasic, "sbrkbasic"},
     {sbrkmuch, "sbrkmuch"},
+    {sbrklazy, "sbrklazy"},
+    {sbrkxoom, "sbrkxoom"},
+    {diskreuse, "diskreuse"},
     {kernmem, "kernmem"},
     {sbrkfail, "sbrkfail"},
     {sbrkarg, "sbrkarg"},
@@ -2162,15 +2669,20 @@ main(int argc, char *argv[])
     {iputtest, "iput"},
     {mem, "mem"},
     {pipe1, "pipe1"},
+    {pipe2test, "pipe2"},
     {preempt, "preempt"},
     {exitwait, "exitwait"},
     {rmdot, "rmdot"},
     {fourteen, "fourteen"},
     {bigfile, "bigfile"},
+    {hugefile, "hugefile"},
     {dirfile, "dirfile"},
     {iref, "iref"},
     {forktest, "forktest"},
+    {cowfork, "cowfork"},
+    {cowread, "cowread"},
     {bigdir, "bigdir"}, // slow
+    {hashdir, "hashdir"},
     { 0, 0},
   };
     
@@ -45,3 +45,7 @@ entry("cinit");
 entry("cpause");
 entry("cresume");
 entry("cstop");
+entry("csched");
+entry("kstat");
+entry("pipe2");
+entry("trace");